@@ -5,10 +5,11 @@
 #include "bits.h"
 #include "config.h"
 #include "fdt.h"
+#include "disabled_hart_mask.h"
 #include <string.h>
 
 static const void* entry_point;
-long disabled_hart_mask;
+hartmask_t disabled_hart_mask;
 
 static uintptr_t dtb_output()
 {
@@ -39,7 +40,7 @@ void boot_other_hart(uintptr_t unused __attribute__((unused)))
   } while (!entry);
 
   long hartid = read_csr(mhartid);
-  if ((1 << hartid) & disabled_hart_mask) {
+  if (hartmask_test(&disabled_hart_mask, hartid)) {
     while (1) {
       __asm__ volatile("wfi");
 #ifdef __riscv_div
@@ -0,0 +1,129 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdint.h>
+#include "mcall.h"
+#include "bits.h"
+
+/*
+ * Helpers of the benchmark payloads, which bbl boots in place of a kernel,
+ * e.g. with --with-payload=aead_bench. Only the first hart to arrive runs
+ * the benchmark, the others sleep in S-mode, where they still take remote
+ * fences and IPIs. Results are in ticks of the time CSR.
+ */
+#define BENCH_STACK_SIZE 8192
+// harts still booting are waited for until none arrives for this long
+#define BENCH_SETTLE_TICKS 1000000
+
+// bbl copies the payload as a flat binary, so everything is reached pc-relative
+#define BENCH_ENTRY(fn) \
+  asm (".section .text.init, \"ax\", @progbits\n" \
+       ".globl _start\n" \
+       "_start:\n" \
+       "  la t0, bench_arrived\n" \
+       "  li t1, 1\n" \
+       "  amoadd.w x0, t1, (t0)\n" \
+       "  la t0, bench_started\n" \
+       "  amoswap.w t0, t1, (t0)\n" \
+       "  bnez t0, 2f\n" \
+       "  la sp, bench_stack + " STR(BENCH_STACK_SIZE) "\n" \
+       "  call " #fn "\n" \
+       "  li a7, " STR(SBI_SHUTDOWN) "\n" \
+       "  ecall\n" \
+       "2:\n" \
+       "  wfi\n" \
+       "  j 2b\n" \
+       ".previous"); \
+  int bench_started; \
+  volatile int bench_arrived; \
+  char bench_stack[BENCH_STACK_SIZE] __attribute__((aligned(16)))
+
+struct bench_sbiret {
+  long error;
+  long value;
+};
+
+static inline struct bench_sbiret bench_sbi(uintptr_t eid, uintptr_t fid,
+    uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4)
+{
+  register uintptr_t a0 asm ("a0") = arg0;
+  register uintptr_t a1 asm ("a1") = arg1;
+  register uintptr_t a2 asm ("a2") = arg2;
+  register uintptr_t a3 asm ("a3") = arg3;
+  register uintptr_t a4 asm ("a4") = arg4;
+  register uintptr_t a6 asm ("a6") = fid;
+  register uintptr_t a7 asm ("a7") = eid;
+  asm volatile ("ecall"
+                : "+r" (a0), "+r" (a1)
+                : "r" (a2), "r" (a3), "r" (a4), "r" (a6), "r" (a7)
+                : "memory");
+  return (struct bench_sbiret){a0, a1};
+}
+
+static inline uintptr_t bench_time()
+{
+  uintptr_t t;
+  asm volatile ("rdtime %0" : "=r" (t));
+  return t;
+}
+
+extern volatile int bench_arrived;
+
+// wait until every hart has entered the payload, return their number
+static inline int bench_wait_for_harts()
+{
+  int harts = bench_arrived;
+  uintptr_t since = bench_time();
+
+  while (bench_time() - since < BENCH_SETTLE_TICKS) {
+    if (bench_arrived != harts) {
+      harts = bench_arrived;
+      since = bench_time();
+    }
+  }
+  return harts;
+}
+
+static inline void bench_putchar(char c)
+{
+  bench_sbi(SBI_CONSOLE_PUTCHAR, 0, c, 0, 0, 0, 0);
+}
+
+static inline void bench_puts(const char* s)
+{
+  while (*s)
+    bench_putchar(*s++);
+}
+
+static inline void bench_putu(unsigned long n)
+{
+  char buf[24];
+  int i = sizeof(buf);
+
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  bench_puts(&buf[i]);
+}
+
+// "name: count unit in ticks ticks (ticks per 1000 unit)"
+static inline void bench_report(const char* name, unsigned long count,
+                                const char* unit, unsigned long ticks)
+{
+  bench_puts(name);
+  bench_puts(": ");
+  bench_putu(count);
+  bench_puts(" ");
+  bench_puts(unit);
+  bench_puts(" in ");
+  bench_putu(ticks);
+  bench_puts(" ticks (");
+  bench_putu(count ? ticks * 1000 / count : 0);
+  bench_puts(" per 1000 ");
+  bench_puts(unit);
+  bench_puts(")\n");
+}
+
+#endif
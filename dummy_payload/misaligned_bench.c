@@ -0,0 +1,43 @@
+// Throughput of misaligned loads and stores, which bbl emulates in M-mode
+
+#include "bench.h"
+
+#define MISALIGNED_BENCH_ACCESSES 10000
+
+static uint64_t misaligned_bench_buf[4] __attribute__((aligned(16)));
+
+#define MISALIGNED_LOAD(insn, offset) ({ \
+  uintptr_t start = bench_time(), val; \
+  for (int i = 0; i < MISALIGNED_BENCH_ACCESSES; i++) \
+    asm volatile (#insn " %0, " #offset "(%1)" \
+                  : "=r" (val) : "r" (misaligned_bench_buf) : "memory"); \
+  bench_time() - start; })
+
+#define MISALIGNED_STORE(insn, offset) ({ \
+  uintptr_t start = bench_time(); \
+  for (int i = 0; i < MISALIGNED_BENCH_ACCESSES; i++) \
+    asm volatile (#insn " %0, " #offset "(%1)" \
+                  :: "r" (i), "r" (misaligned_bench_buf) : "memory"); \
+  bench_time() - start; })
+
+#define MISALIGNED_BENCH(name, ticks) \
+  bench_report(name, MISALIGNED_BENCH_ACCESSES, "accesses", ticks)
+
+void misaligned_bench(uintptr_t hartid, uintptr_t dtb)
+{
+#if __riscv_xlen == 64
+  MISALIGNED_BENCH("ld +1", MISALIGNED_LOAD(ld, 1));
+  MISALIGNED_BENCH("ld +4", MISALIGNED_LOAD(ld, 4));
+  MISALIGNED_BENCH("sd +1", MISALIGNED_STORE(sd, 1));
+  MISALIGNED_BENCH("sd +4", MISALIGNED_STORE(sd, 4));
+#endif
+  MISALIGNED_BENCH("lw +1", MISALIGNED_LOAD(lw, 1));
+  MISALIGNED_BENCH("lw +2", MISALIGNED_LOAD(lw, 2));
+  MISALIGNED_BENCH("lw +7", MISALIGNED_LOAD(lw, 7));
+  MISALIGNED_BENCH("sh +1", MISALIGNED_STORE(sh, 1));
+  MISALIGNED_BENCH("sh +7", MISALIGNED_STORE(sh, 7));
+  // aligned for reference, it does not trap
+  MISALIGNED_BENCH("lw +0", MISALIGNED_LOAD(lw, 0));
+}
+
+BENCH_ENTRY(misaligned_bench);
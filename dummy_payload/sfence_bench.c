@@ -0,0 +1,45 @@
+// Cost of remote sfence.vma of growing ranges on all harts
+
+#include "bench.h"
+
+#define SFENCE_BENCH_CALLS 1000
+#define SFENCE_BENCH_PAGE_SIZE 4096
+#define SFENCE_BENCH_START 0x10000000
+// one more than SFENCE_VMA_MAX_PAGES, targets flush the whole TLB instead
+#define SFENCE_BENCH_MAX_PAGES 65
+
+static void sfence_bench_run(uintptr_t fid, uintptr_t pages, uintptr_t asid)
+{
+  uintptr_t size = pages ? pages * SFENCE_BENCH_PAGE_SIZE : -1UL;
+  uintptr_t start;
+  int i;
+
+  start = bench_time();
+  for (i = 0; i < SFENCE_BENCH_CALLS; i++)
+    bench_sbi(SBI_EXT_RFENCE, fid, 0, -1UL, SFENCE_BENCH_START, size, asid);
+  if (pages) {
+    bench_putu(pages);
+    bench_puts(" pages, ");
+  } else {
+    bench_puts("all pages, ");
+  }
+  bench_report(asid ? "asid sfence.vma" : "sfence.vma", SFENCE_BENCH_CALLS,
+               "calls", bench_time() - start);
+}
+
+void sfence_bench(uintptr_t hartid, uintptr_t dtb)
+{
+  uintptr_t pages;
+
+  bench_puts("sfence_bench: ");
+  bench_putu(bench_wait_for_harts());
+  bench_puts(" harts\n");
+
+  for (pages = 1; pages <= SFENCE_BENCH_MAX_PAGES; pages *= 2)
+    sfence_bench_run(SBI_EXT_RFENCE_REMOTE_SFENCE_VMA, pages, 0);
+  sfence_bench_run(SBI_EXT_RFENCE_REMOTE_SFENCE_VMA, SFENCE_BENCH_MAX_PAGES, 0);
+  sfence_bench_run(SBI_EXT_RFENCE_REMOTE_SFENCE_VMA, 0, 0);
+  sfence_bench_run(SBI_EXT_RFENCE_REMOTE_SFENCE_VMA_ASID, 1, 1);
+}
+
+BENCH_ENTRY(sfence_bench);
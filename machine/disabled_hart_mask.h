@@ -1,4 +1,5 @@
 #ifndef DISABLED_HART_MASK_H
 #define DISABLED_HART_MASK_H
-extern long disabled_hart_mask;
+#include "hartmask.h"
+extern hartmask_t disabled_hart_mask;
 #endif
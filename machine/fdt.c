@@ -200,7 +200,7 @@ void query_mem(uintptr_t fdt)
 ///////////////////////////////////////////// HART SCAN //////////////////////////////////////////
 
 static uint32_t hart_phandles[MAX_HARTS];
-uint64_t hart_mask;
+hartmask_t hart_mask;
 
 struct hart_scan {
   const struct fdt_scan_node *cpu;
@@ -256,7 +256,7 @@ static void hart_done(const struct fdt_scan_node *node, void *extra)
 
     if (scan->hart < MAX_HARTS) {
       hart_phandles[scan->hart] = scan->phandle;
-      hart_mask |= 1 << scan->hart;
+      hartmask_set(&hart_mask, scan->hart);
       hls_init(scan->hart);
     }
   }
@@ -286,7 +286,7 @@ void query_harts(uintptr_t fdt)
   fdt_scan(fdt, &cb);
 
   // The current hart should have been detected
-  assert ((hart_mask >> read_csr(mhartid)) != 0);
+  assert (hartmask_test(&hart_mask, read_csr(mhartid)));
 }
 
 ///////////////////////////////////////////// CLINT SCAN /////////////////////////////////////////
@@ -555,7 +555,7 @@ struct hart_filter {
   int hart;
   char *status;
   char *mmu_type;
-  long *disabled_hart_mask;
+  hartmask_t *disabled_hart_mask;
 };
 
 static void hart_filter_open(const struct fdt_scan_node *node, void *extra)
@@ -606,11 +606,11 @@ static void hart_filter_done(const struct fdt_scan_node *node, void *extra)
     strcpy(filter->status, "masked");
     uint32_t *len = (uint32_t*)filter->status;
     len[-2] = bswap(strlen("masked")+1);
-    *filter->disabled_hart_mask |= (1 << filter->hart);
+    hartmask_set(filter->disabled_hart_mask, filter->hart);
   }
 }
 
-void filter_harts(uintptr_t fdt, long *disabled_hart_mask)
+void filter_harts(uintptr_t fdt, hartmask_t *disabled_hart_mask)
 {
   struct fdt_cb cb;
   struct hart_filter filter;
@@ -622,7 +622,7 @@ void filter_harts(uintptr_t fdt, long *disabled_hart_mask)
   cb.extra = &filter;
 
   filter.disabled_hart_mask = disabled_hart_mask;
-  *disabled_hart_mask = 0;
+  hartmask_zero(disabled_hart_mask);
   fdt_scan(fdt, &cb);
 }
 
@@ -1,6 +1,8 @@
 #ifndef FDT_H
 #define FDT_H
 
+#include "hartmask.h"
+
 #define FDT_MAGIC	0xd00dfeed
 #define FDT_VERSION	17
 
@@ -61,12 +63,12 @@ void query_plic(uintptr_t fdt);
 void query_clint(uintptr_t fdt);
 
 // Remove information from FDT
-void filter_harts(uintptr_t fdt, long *disabled_hart_mask);
+void filter_harts(uintptr_t fdt, hartmask_t *disabled_hart_mask);
 void filter_plic(uintptr_t fdt);
 void filter_compat(uintptr_t fdt, const char *compat);
 
 // The hartids of available harts
-extern uint64_t hart_mask;
+extern hartmask_t hart_mask;
 
 #ifdef PK_PRINT_DEVICE_TREE
 // Prints the device tree to the console as a DTS
@@ -0,0 +1,77 @@
+#ifndef _RISCV_HARTMASK_H
+#define _RISCV_HARTMASK_H
+
+#include "mtrap.h"
+
+// A set of harts, as many words as MAX_HARTS needs
+#define HARTMASK_WORD_BITS (8 * sizeof(uintptr_t))
+#define HARTMASK_WORDS ((MAX_HARTS + HARTMASK_WORD_BITS - 1) / HARTMASK_WORD_BITS)
+
+typedef struct {
+  uintptr_t bits[HARTMASK_WORDS];
+} hartmask_t;
+
+static inline int hartmask_test(const hartmask_t* mask, uintptr_t hart)
+{
+  if (hart >= MAX_HARTS)
+    return 0;
+  return (mask->bits[hart / HARTMASK_WORD_BITS] >> (hart % HARTMASK_WORD_BITS)) & 1;
+}
+
+static inline void hartmask_set(hartmask_t* mask, uintptr_t hart)
+{
+  if (hart < MAX_HARTS)
+    mask->bits[hart / HARTMASK_WORD_BITS] |= 1UL << (hart % HARTMASK_WORD_BITS);
+}
+
+static inline void hartmask_clear(hartmask_t* mask, uintptr_t hart)
+{
+  if (hart < MAX_HARTS)
+    mask->bits[hart / HARTMASK_WORD_BITS] &= ~(1UL << (hart % HARTMASK_WORD_BITS));
+}
+
+static inline void hartmask_zero(hartmask_t* mask)
+{
+  for (size_t i = 0; i < HARTMASK_WORDS; i++)
+    mask->bits[i] = 0;
+}
+
+// dst = a & ~b, dst may be a or b
+static inline void hartmask_andnot(hartmask_t* dst, const hartmask_t* a, const hartmask_t* b)
+{
+  for (size_t i = 0; i < HARTMASK_WORDS; i++)
+    dst->bits[i] = a->bits[i] & ~b->bits[i];
+}
+
+// dst = a & b, dst may be a or b
+static inline void hartmask_and(hartmask_t* dst, const hartmask_t* a, const hartmask_t* b)
+{
+  for (size_t i = 0; i < HARTMASK_WORDS; i++)
+    dst->bits[i] = a->bits[i] & b->bits[i];
+}
+
+// the first hart in mask from hart on, MAX_HARTS if there is none
+static inline uintptr_t hartmask_next(const hartmask_t* mask, uintptr_t hart)
+{
+  while (hart < MAX_HARTS) {
+    uintptr_t word = mask->bits[hart / HARTMASK_WORD_BITS] >> (hart % HARTMASK_WORD_BITS);
+    if (word)
+      return hart + __builtin_ctzl(word);
+    hart = (hart / HARTMASK_WORD_BITS + 1) * HARTMASK_WORD_BITS;
+  }
+  return MAX_HARTS;
+}
+
+#define for_each_hart(hart, mask) \
+  for ((hart) = hartmask_next(mask, 0); (hart) < MAX_HARTS; (hart) = hartmask_next(mask, (hart) + 1))
+
+// harts base + i for every bit i of mask, as passed to SBI calls
+static inline void hartmask_from_sbi(hartmask_t* dst, uintptr_t mask, uintptr_t base)
+{
+  hartmask_zero(dst);
+  for (uintptr_t i = 0; mask && base + i < MAX_HARTS; i++, mask >>= 1)
+    if (mask & 1)
+      hartmask_set(dst, base + i);
+}
+
+#endif
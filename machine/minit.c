@@ -7,12 +7,14 @@
 #include "uart16550.h"
 #include "finisher.h"
 #include "disabled_hart_mask.h"
+#include "sbi_ext.h"
 #include "htif.h"
 #include <string.h>
 #include <limits.h>
 
 #ifdef SM_ENABLED
 #include "sm.h"
+#include "swap.h"
 #endif /* SM_ENABLED */
 
 pte_t* root_page_table;
@@ -81,6 +83,11 @@ static void fp_init()
 
 hls_t* hls_init(uintptr_t id)
 {
+  _Static_assert(sizeof(hls_t) <= HLS_SIZE, "hls_t > HLS_SIZE");
+  _Static_assert(offsetof(hls_t, in_enclave) == MENTRY_IN_ENCLAVE_OFFSET - MENTRY_HLS_OFFSET,
+                 "MENTRY_IN_ENCLAVE_OFFSET does not match hls_t");
+  _Static_assert(offsetof(hls_t, timecmp) == MENTRY_TIMECMP_OFFSET - MENTRY_HLS_OFFSET,
+                 "MENTRY_TIMECMP_OFFSET does not match hls_t");
   hls_t* hls = OTHER_HLS(id);
   memset(hls, 0, sizeof(*hls));
   return hls;
@@ -136,9 +143,12 @@ static void hart_plic_init()
 
 static void wake_harts()
 {
-  for (int hart = 0; hart < MAX_HARTS; ++hart)
-    if ((((~disabled_hart_mask & hart_mask) >> hart) & 1))
-      *OTHER_HLS(hart)->ipi = 1; // wakeup the hart
+  hartmask_t mask;
+  uintptr_t hart;
+
+  hartmask_andnot(&mask, &hart_mask, &disabled_hart_mask);
+  for_each_hart(hart, &mask)
+    *OTHER_HLS(hart)->ipi = 1; // wakeup the hart
 }
 
 void init_first_hart(uintptr_t hartid, uintptr_t dtb)
@@ -159,7 +169,12 @@ void init_first_hart(uintptr_t hartid, uintptr_t dtb)
   query_harts(dtb);
   query_clint(dtb);
   query_plic(dtb);
+#ifdef SM_ENABLED
+  // before the seeds in dtb are handed on to the host
+  query_swap_seed(dtb);
+#endif /* SM_ENABLED */
 
+  sbi_init();
   wake_harts();
 
   plic_init();
@@ -176,6 +191,21 @@ void init_other_hart(uintptr_t hartid, uintptr_t dtb)
   boot_other_hart(dtb);
 }
 
+static void __attribute__((noreturn)) mret_to_supervisor(void (*fn)(uintptr_t), uintptr_t arg0, uintptr_t arg1)
+{
+  uintptr_t mstatus = read_csr(mstatus);
+  mstatus = INSERT_FIELD(mstatus, MSTATUS_MPP, PRV_S);
+  mstatus = INSERT_FIELD(mstatus, MSTATUS_MPIE, 0);
+  write_csr(mstatus, mstatus);
+  write_csr(mscratch, MACHINE_STACK_TOP() - MENTRY_FRAME_SIZE);
+  write_csr(mepc, fn);
+
+  register uintptr_t a0 asm ("a0") = arg0;
+  register uintptr_t a1 asm ("a1") = arg1;
+  asm volatile ("mret" : : "r" (a0), "r" (a1));
+  __builtin_unreachable();
+}
+
 void enter_supervisor_mode(void (*fn)(uintptr_t), uintptr_t arg0, uintptr_t arg1)
 {
   // Set up a PMP to permit access to all of memory.
@@ -189,19 +219,17 @@ void enter_supervisor_mode(void (*fn)(uintptr_t), uintptr_t arg0, uintptr_t arg1
                 "1: csrw mtvec, t0"
                 : : "r" (pmpc), "r" (-1UL) : "t0");
 
-  uintptr_t mstatus = read_csr(mstatus);
-  mstatus = INSERT_FIELD(mstatus, MSTATUS_MPP, PRV_S);
-  mstatus = INSERT_FIELD(mstatus, MSTATUS_MPIE, 0);
-  write_csr(mstatus, mstatus);
-  write_csr(mscratch, MACHINE_STACK_TOP() - MENTRY_FRAME_SIZE);
-  write_csr(mepc, fn);
-
 #ifdef SM_ENABLED
   sm_init();
 #endif /* SM_ENABLED */
 
-  register uintptr_t a0 asm ("a0") = arg0;
-  register uintptr_t a1 asm ("a1") = arg1;
-  asm volatile ("mret" : : "r" (a0), "r" (a1));
-  __builtin_unreachable();
+  mret_to_supervisor(fn, arg0, arg1);
+}
+
+// a hart started again by SBI HSM keeps the PMPs, which the SM may own
+void restart_supervisor_mode(void (*fn)(uintptr_t), uintptr_t arg0, uintptr_t arg1)
+{
+  write_csr(satp, 0);
+  clear_csr(mstatus, MSTATUS_SIE);
+  mret_to_supervisor(fn, arg0, arg1);
 }
@@ -65,9 +65,11 @@ void misaligned_load_trap(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc)
   else
     return truly_illegal_insn(regs, mcause, mepc, mstatus, insn);
 
-  val.int64 = 0;
-  for (intptr_t i = 0; i < len; i++)
-    val.bytes[i] = load_uint8_t((void *)(addr + i), mepc);
+  if (len > sizeof(uintptr_t))
+    val.int64 = load_misaligned(addr, 4, mepc)
+                | (uint64_t)load_misaligned(addr + 4, 4, mepc) << 32;
+  else
+    val.int64 = load_misaligned(addr, len, mepc);
 
   if (!fp)
     SET_RD(insn, regs, (intptr_t)val.intx << shift >> shift);
@@ -130,8 +132,12 @@ void misaligned_store_trap(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc)
     return truly_illegal_insn(regs, mcause, mepc, mstatus, insn);
 
   uintptr_t addr = read_csr(mbadaddr);
-  for (int i = 0; i < len; i++)
-    store_uint8_t((void *)(addr + i), val.bytes[i], mepc);
+  if (len > sizeof(uintptr_t)) {
+    store_misaligned(addr, val.int64, 4, mepc);
+    store_misaligned(addr + 4, val.int64 >> 32, 4, mepc);
+  } else {
+    store_misaligned(addr, val.intx, len, mepc);
+  }
 
   write_csr(mepc, npc);
 }
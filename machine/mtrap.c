@@ -10,6 +10,7 @@
 #include "fdt.h"
 #include "unprivileged_memory.h"
 #include "disabled_hart_mask.h"
+#include "sbi_ext.h"
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -59,7 +60,7 @@ void printm(const char* s, ...)
 
 static void send_ipi(uintptr_t recipient, int event)
 {
-  if (((disabled_hart_mask >> recipient) & 1)) return;
+  if (hartmask_test(&disabled_hart_mask, recipient)) return;
   atomic_or(&OTHER_HLS(recipient)->mipi_pending, event);
   mb();
   *OTHER_HLS(recipient)->ipi = 1;
@@ -96,17 +97,121 @@ static uintptr_t mcall_set_timer(uint64_t when)
   return 0;
 }
 
-static void send_ipi_many(uintptr_t* pmask, int event)
+// remote sfence.vma of more pages than this flushes the whole TLB
+#define SFENCE_VMA_MAX_PAGES 64
+#define SFENCE_VMA_ALL_ASIDS -1UL
+
+struct sfence_vma_range {
+  uintptr_t start;
+  uintptr_t size;
+  uintptr_t asid;
+};
+
+// merge range into the sfence.vma pending on hart, NULL flushes everything
+static void queue_sfence_vma(uintptr_t hart, const struct sfence_vma_range* range)
+{
+  hls_t* hls = OTHER_HLS(hart);
+  uintptr_t start = 0, end = -1UL, asid = SFENCE_VMA_ALL_ASIDS;
+
+  // a size of 0 or -1 asks for the whole address space
+  if (range && range->size && range->size <= SFENCE_VMA_MAX_PAGES * RISCV_PGSIZE) {
+    start = range->start;
+    end = start + range->size < start ? -1UL : start + range->size;
+  }
+  if (range)
+    asid = range->asid;
+
+  spinlock_lock(&hls->sfence_lock);
+  if (hls->sfence_pending) {
+    start = MIN(start, hls->sfence_start);
+    end = MAX(end, hls->sfence_end);
+    if (asid != hls->sfence_asid)
+      asid = SFENCE_VMA_ALL_ASIDS;
+  }
+  hls->sfence_start = start;
+  hls->sfence_end = end;
+  hls->sfence_asid = asid;
+  hls->sfence_pending = 1;
+  hls->sfence_queued++;
+  spinlock_unlock(&hls->sfence_lock);
+}
+
+// flush the range pending on this hart page by page, or all at once if it is large
+void flush_pending_sfence_vma()
+{
+  hls_t* hls = HLS();
+  uintptr_t start, end, asid, queued;
+
+  spinlock_lock(&hls->sfence_lock);
+  if (!hls->sfence_pending) {
+    spinlock_unlock(&hls->sfence_lock);
+    return;
+  }
+  start = hls->sfence_start;
+  end = hls->sfence_end;
+  asid = hls->sfence_asid;
+  queued = hls->sfence_queued;
+  hls->sfence_pending = 0;
+  spinlock_unlock(&hls->sfence_lock);
+
+  if (end - start > SFENCE_VMA_MAX_PAGES * RISCV_PGSIZE) {
+    if (asid == SFENCE_VMA_ALL_ASIDS)
+      asm volatile ("sfence.vma" ::: "memory");
+    else
+      asm volatile ("sfence.vma x0, %0" :: "r"(asid) : "memory");
+  } else {
+    for (uintptr_t va = start & -RISCV_PGSIZE; va < end; va += RISCV_PGSIZE) {
+      if (asid == SFENCE_VMA_ALL_ASIDS)
+        asm volatile ("sfence.vma %0" :: "r"(va) : "memory");
+      else
+        asm volatile ("sfence.vma %0, %1" :: "r"(va), "r"(asid) : "memory");
+    }
+  }
+
+  // senders wait for this, so only publish it once the TLB is clean
+  mb();
+  hls->sfence_done = queued;
+}
+
+void handle_sfence_vma_ipi(uintptr_t* regs, uintptr_t dummy, uintptr_t mepc)
 {
-  _Static_assert(MAX_HARTS <= 8 * sizeof(*pmask), "# harts > uintptr_t bits");
-  uintptr_t mask = hart_mask;
+  flush_pending_sfence_vma();
+}
+
+// handle what the targets may themselves be waiting for on this hart
+static void send_ipi_wait_poll(uint32_t* incoming_ipi)
+{
+  *incoming_ipi |= atomic_swap(HLS()->ipi, 0);
+  flush_pending_sfence_vma();
+#ifdef SM_ENABLED
+  handle_ipi_mail();
+#endif
+}
+
+// pmask of NULL selects all harts, range is only used by IPI_SFENCE_VMA
+static void send_ipi_many(const hartmask_t* pmask, int event,
+                          const struct sfence_vma_range* range)
+{
+  hartmask_t mask = hart_mask;
+  uintptr_t i;
   if (pmask)
-    mask &= load_uintptr_t(pmask, read_csr(mepc));
+    hartmask_and(&mask, &mask, pmask);
+
+#ifdef SM_ENABLED
+  // harts parked in an enclave have no host to take soft irqs
+  if (event == IPI_SOFT) {
+    hartmask_t exclusive;
+    get_exclusive_hart_mask(&exclusive);
+    hartmask_andnot(&mask, &mask, &exclusive);
+  }
+#endif
 
   // send IPIs to everyone
-  for (uintptr_t i = 0, m = mask; m; i++, m >>= 1)
-    if (m & 1)
-      send_ipi(i, event);
+  for_each_hart(i, &mask) {
+    if (event == IPI_SFENCE_VMA)
+      queue_sfence_vma(i, range);
+    send_ipi(i, event);
+  }
 
   if (event == IPI_SOFT)
     return;
@@ -114,10 +219,17 @@ static void send_ipi_many(uintptr_t* pmask, int event)
   // wait until all events have been handled.
   // prevent deadlock by consuming incoming IPIs.
   uint32_t incoming_ipi = 0;
-  for (uintptr_t i = 0, m = mask; m; i++, m >>= 1)
-    if (m & 1)
-      while (*OTHER_HLS(i)->ipi)
-        incoming_ipi |= atomic_swap(HLS()->ipi, 0);
+  for_each_hart(i, &mask) {
+    while (*OTHER_HLS(i)->ipi)
+      send_ipi_wait_poll(&incoming_ipi);
+    // a remote flush is only done when the target has flushed its TLB,
+    // which covers our range once it catches up with the queued count
+    if (event == IPI_SFENCE_VMA && !hartmask_test(&disabled_hart_mask, i)) {
+      uintptr_t queued = OTHER_HLS(i)->sfence_queued;
+      while ((intptr_t)(OTHER_HLS(i)->sfence_done - queued) < 0)
+        send_ipi_wait_poll(&incoming_ipi);
+    }
+  }
 
   // if we got an IPI, restore it; it will be taken after returning
   if (incoming_ipi) {
@@ -126,94 +238,256 @@ static void send_ipi_many(uintptr_t* pmask, int event)
   }
 }
 
-void mcall_trap(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc)
+// legacy calls pass a single word of harts 0..XLEN-1
+static uintptr_t mcall_send_ipi(uintptr_t* pmask, int event,
+                                const struct sfence_vma_range* range)
 {
-  write_csr(mepc, mepc + 4);
+  hartmask_t mask;
+
+  if (!pmask) {
+    send_ipi_many(NULL, event, range);
+    return 0;
+  }
 
-  uintptr_t n = regs[17], arg0 = regs[10], arg1 = regs[11], arg2 = regs[12], retval, ipi_type;
+  hartmask_from_sbi(&mask, load_uintptr_t(pmask, read_csr(mepc)), 0);
+  send_ipi_many(&mask, event, range);
+  return 0;
+}
 
-  switch (n)
-  {
-    case SBI_CONSOLE_PUTCHAR:
-      retval = mcall_console_putchar(arg0);
-      break;
-    case SBI_CONSOLE_GETCHAR:
-      retval = mcall_console_getchar();
-      break;
-    case SBI_SEND_IPI:
-      ipi_type = IPI_SOFT;
-      goto send_ipi;
-    case SBI_REMOTE_SFENCE_VMA:
-    case SBI_REMOTE_SFENCE_VMA_ASID:
-      ipi_type = IPI_SFENCE_VMA;
-      goto send_ipi;
-    case SBI_REMOTE_FENCE_I:
-      ipi_type = IPI_FENCE_I;
-send_ipi:
-      send_ipi_many((uintptr_t*)arg0, ipi_type);
-      retval = 0;
-      break;
-    case SBI_CLEAR_IPI:
-      retval = mcall_clear_ipi();
-      break;
-    case SBI_SHUTDOWN:
-      retval = mcall_shutdown();
-      break;
-    case SBI_SET_TIMER:
+// harts base + i for every bit i of mask, a base of -1 selects all harts
+static uintptr_t mcall_send_ipi_base(uintptr_t mask, uintptr_t base, int event,
+                                     const struct sfence_vma_range* range)
+{
+  hartmask_t harts;
+
+  if (base == -1UL) {
+    send_ipi_many(NULL, event, range);
+    return 0;
+  }
+  if (base >= MAX_HARTS)
+    return SBI_ERR_INVALID_PARAM;
+
+  hartmask_from_sbi(&harts, mask, base);
+  send_ipi_many(&harts, event, range);
+  return 0;
+}
+
+static struct sbiret sbi_console_putchar(uintptr_t* regs)
+{
+  return SBI_RET(0, mcall_console_putchar(regs[10]));
+}
+
+static struct sbiret sbi_console_getchar(uintptr_t* regs)
+{
+  return SBI_RET(0, mcall_console_getchar());
+}
+
+static struct sbiret sbi_clear_ipi(uintptr_t* regs)
+{
+  return SBI_RET(0, mcall_clear_ipi());
+}
+
+static struct sbiret sbi_shutdown(uintptr_t* regs)
+{
+  return SBI_RET(0, mcall_shutdown());
+}
+
+static struct sbiret sbi_set_timer(uintptr_t* regs)
+{
 #if __riscv_xlen == 32
-      retval = mcall_set_timer(arg0 + ((uint64_t)arg1 << 32));
+  uint64_t deadline = regs[10] + ((uint64_t)regs[11] << 32);
 #else
-      retval = mcall_set_timer(arg0);
+  uint64_t deadline = regs[10];
 #endif
-      break;
-
 #ifdef SM_ENABLED
+  // an enclave only sets its own deadline
+  if (check_in_enclave_world() == 0)
+    return SBI_RET(0, sm_enclave_set_timer(deadline));
+#endif
+  return SBI_RET(0, mcall_set_timer(deadline));
+}
 
-    case SBI_MM_INIT:
-      retval = sm_mm_init(arg0, arg1);
-      break;
-    case SBI_MEMORY_EXTEND:
-      retval = sm_mm_extend(arg0, arg1);
-      break;
-    case SBI_ALLOC_ENCLAVE_MM:
-      retval = sm_alloc_enclave_mem(arg0);
-      break;
-    case SBI_CREATE_ENCLAVE:
-      retval = sm_create_enclave(arg0);
-      break;
-    case SBI_ATTEST_ENCLAVE:
-      retval = 0;//sm_attest_enclave(arg0, arg1, arg2);
-    case SBI_RUN_ENCLAVE:
-      retval = sm_run_enclave(regs, arg0);
-      break;
-    case SBI_STOP_ENCLAVE:
-      retval = sm_stop_enclave(regs, arg0);
-      break;
-    case SBI_RESUME_ENCLAVE:
-      retval = sm_resume_enclave(regs, arg0);
-      break;
-    case SBI_DESTROY_ENCLAVE:
-      retval = 0;//sm_destroy_enclave(regs, arg0,arg1);
-      break;
-    case SBI_ENCLAVE_OCALL:
-      retval = 0;//sm_enclave_ocall(regs, arg0);
-      break;
-    case SBI_EXIT_ENCLAVE:
-      retval = sm_exit_enclave(regs, arg0);
-      break;
-    //TODO: delete this SBI_CALL
-    case SBI_DEBUG_PRINT:
-      printm("SBI_DEBUG_PRINT\r\n");
-      retval = sm_debug_print(regs, arg0);
-      break;
+static struct sbiret sbi_legacy_send_ipi(uintptr_t* regs)
+{
+  return SBI_RET(0, mcall_send_ipi((uintptr_t*)regs[10], IPI_SOFT, NULL));
+}
 
-#endif /* SM_ENABLED */
+static struct sbiret sbi_legacy_remote_fence_i(uintptr_t* regs)
+{
+  return SBI_RET(0, mcall_send_ipi((uintptr_t*)regs[10], IPI_FENCE_I, NULL));
+}
 
-    default:
-      retval = -ENOSYS;
-      break;
+static struct sbiret sbi_legacy_remote_sfence_vma(uintptr_t* regs)
+{
+  struct sfence_vma_range range = { regs[11], regs[12], SFENCE_VMA_ALL_ASIDS };
+  return SBI_RET(0, mcall_send_ipi((uintptr_t*)regs[10], IPI_SFENCE_VMA, &range));
+}
+
+static struct sbiret sbi_legacy_remote_sfence_vma_asid(uintptr_t* regs)
+{
+  struct sfence_vma_range range = { regs[11], regs[12], regs[13] };
+  return SBI_RET(0, mcall_send_ipi((uintptr_t*)regs[10], IPI_SFENCE_VMA, &range));
+}
+
+static struct sbiret sbi_send_ipi(uintptr_t* regs)
+{
+  return SBI_RET(mcall_send_ipi_base(regs[10], regs[11], IPI_SOFT, NULL), 0);
+}
+
+static struct sbiret sbi_remote_fence_i(uintptr_t* regs)
+{
+  return SBI_RET(mcall_send_ipi_base(regs[10], regs[11], IPI_FENCE_I, NULL), 0);
+}
+
+static struct sbiret sbi_remote_sfence_vma(uintptr_t* regs)
+{
+  struct sfence_vma_range range = { regs[12], regs[13], SFENCE_VMA_ALL_ASIDS };
+  return SBI_RET(mcall_send_ipi_base(regs[10], regs[11], IPI_SFENCE_VMA, &range), 0);
+}
+
+static struct sbiret sbi_remote_sfence_vma_asid(uintptr_t* regs)
+{
+  struct sfence_vma_range range = { regs[12], regs[13], regs[14] };
+  return SBI_RET(mcall_send_ipi_base(regs[10], regs[11], IPI_SFENCE_VMA, &range), 0);
+}
+
+// a stopped hart still completes the requests other harts wait for
+static void __attribute__((noreturn)) hsm_wait_for_start()
+{
+  hls_t* hls = HLS();
+  uint32_t pending;
+
+  while (!hls->hsm_start_ready) {
+    wfi();
+    if (!*hls->ipi)
+      continue;
+    *hls->ipi = 0;
+    mb();
+    pending = atomic_swap(&hls->mipi_pending, 0);
+    if (pending & IPI_SFENCE_VMA)
+      flush_pending_sfence_vma();
+#ifdef SM_ENABLED
+    if (pending & IPI_MAIL)
+      handle_ipi_mail();
+#endif
   }
-  regs[10] = retval;
+
+  mb();
+  hls->hsm_state = SBI_HSM_STATE_STARTED;
+  asm volatile ("fence.i");
+  restart_supervisor_mode((void*)hls->hsm_start_addr, read_csr(mhartid), hls->hsm_opaque);
+}
+
+static struct sbiret sbi_hsm_hart_start(uintptr_t* regs)
+{
+  uintptr_t hart = regs[10];
+  hls_t* hls;
+
+#ifdef SM_ENABLED
+  if (check_in_enclave_world() == 0)
+    return SBI_RET(SBI_ERR_DENIED, 0);
+#endif
+  if (!hartmask_test(&hart_mask, hart) || hartmask_test(&disabled_hart_mask, hart))
+    return SBI_RET(SBI_ERR_INVALID_PARAM, 0);
+
+  hls = OTHER_HLS(hart);
+  if (atomic_cas(&hls->hsm_state, SBI_HSM_STATE_STOPPED, SBI_HSM_STATE_START_PENDING)
+      != SBI_HSM_STATE_STOPPED)
+    return SBI_RET(SBI_ERR_ALREADY_AVAILABLE, 0);
+
+  hls->hsm_start_addr = regs[11];
+  hls->hsm_opaque = regs[12];
+  mb();
+  hls->hsm_start_ready = 1;
+  mb();
+  *hls->ipi = 1;
+
+  return SBI_RET(SBI_SUCCESS, 0);
+}
+
+static struct sbiret sbi_hsm_hart_stop(uintptr_t* regs)
+{
+  hls_t* hls = HLS();
+
+#ifdef SM_ENABLED
+  if (check_in_enclave_world() == 0)
+    return SBI_RET(SBI_ERR_DENIED, 0);
+#endif
+
+  // no S-mode interrupt is taken until the hart is started again
+  clear_csr(mie, MIP_MTIP);
+  clear_csr(mip, MIP_STIP | MIP_SSIP);
+  hls->hsm_start_ready = 0;
+  mb();
+  hls->hsm_state = SBI_HSM_STATE_STOPPED;
+  hsm_wait_for_start();
+}
+
+static struct sbiret sbi_hsm_hart_get_status(uintptr_t* regs)
+{
+  uintptr_t hart = regs[10];
+
+  if (!hartmask_test(&hart_mask, hart) || hartmask_test(&disabled_hart_mask, hart))
+    return SBI_RET(SBI_ERR_INVALID_PARAM, 0);
+  return SBI_RET(SBI_SUCCESS, OTHER_HLS(hart)->hsm_state);
+}
+
+static const sbi_fn_t sbi_time_fns[] = {
+  [SBI_EXT_TIME_SET_TIMER] = sbi_set_timer,
+};
+
+static const sbi_fn_t sbi_ipi_fns[] = {
+  [SBI_EXT_IPI_SEND_IPI] = sbi_send_ipi,
+};
+
+static const sbi_fn_t sbi_rfence_fns[] = {
+  [SBI_EXT_RFENCE_REMOTE_FENCE_I] = sbi_remote_fence_i,
+  [SBI_EXT_RFENCE_REMOTE_SFENCE_VMA] = sbi_remote_sfence_vma,
+  [SBI_EXT_RFENCE_REMOTE_SFENCE_VMA_ASID] = sbi_remote_sfence_vma_asid,
+};
+
+static const sbi_fn_t sbi_hsm_fns[] = {
+  [SBI_EXT_HSM_HART_START] = sbi_hsm_hart_start,
+  [SBI_EXT_HSM_HART_STOP] = sbi_hsm_hart_stop,
+  [SBI_EXT_HSM_HART_GET_STATUS] = sbi_hsm_hart_get_status,
+};
+
+#define SBI_FNS(fns) fns, sizeof(fns) / sizeof(fns[0])
+
+static const struct sbi_ext sbi_exts[] = {
+  { SBI_EXT_TIME, SBI_FNS(sbi_time_fns), 0 },
+  { SBI_EXT_IPI, SBI_FNS(sbi_ipi_fns), 0 },
+  { SBI_EXT_RFENCE, SBI_FNS(sbi_rfence_fns), 0 },
+  { SBI_EXT_HSM, SBI_FNS(sbi_hsm_fns), 0 },
+};
+
+void sbi_init()
+{
+  sbi_ext_init();
+
+  sbi_register_legacy(SBI_SET_TIMER, sbi_set_timer);
+  sbi_register_legacy(SBI_CONSOLE_PUTCHAR, sbi_console_putchar);
+  sbi_register_legacy(SBI_CONSOLE_GETCHAR, sbi_console_getchar);
+  sbi_register_legacy(SBI_CLEAR_IPI, sbi_clear_ipi);
+  sbi_register_legacy(SBI_SEND_IPI, sbi_legacy_send_ipi);
+  sbi_register_legacy(SBI_REMOTE_FENCE_I, sbi_legacy_remote_fence_i);
+  sbi_register_legacy(SBI_REMOTE_SFENCE_VMA, sbi_legacy_remote_sfence_vma);
+  sbi_register_legacy(SBI_REMOTE_SFENCE_VMA_ASID, sbi_legacy_remote_sfence_vma_asid);
+  sbi_register_legacy(SBI_SHUTDOWN, sbi_shutdown);
+
+  for (size_t i = 0; i < sizeof(sbi_exts) / sizeof(sbi_exts[0]); i++)
+    sbi_register_ext(&sbi_exts[i]);
+
+#ifdef SM_ENABLED
+  sm_sbi_init();
+#endif
+}
+
+void mcall_trap(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc)
+{
+  write_csr(mepc, mepc + 4);
+
+  sbi_dispatch(regs);
 }
 
 void redirect_trap(uintptr_t epc, uintptr_t mstatus, uintptr_t badaddr)
@@ -275,7 +549,9 @@ void spmp_inst_trap(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc)
   }
 #endif /* SPMP_ENABLED */
 
-  //TODO: deal with enclave page fault
+  if(sm_enclave_page_fault(regs, mcause, read_csr(mbadaddr)) == 0)
+    return;
+
   printm("M mode: inst_page_fault, badaddr: 0x%lx, badepc: 0x%lx\r\n", read_csr(mbadaddr), read_csr(mepc));
   bad_trap(regs, mcause, mepc);
 }
@@ -295,8 +571,9 @@ void spmp_load_trap(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc)
   }
 #endif /* SPMP_ENABLED */
 
+  if(sm_enclave_page_fault(regs, mcause, read_csr(mbadaddr)) == 0)
+    return;
 
-  //TODO: deal with enclave page fault
   printm("M mode: load_page_fault, badaddr: 0x%lx, badepc: 0x%lx\r\n", read_csr(mbadaddr), read_csr(mepc));
   bad_trap(regs, mcause, mepc);
 }
@@ -316,7 +593,9 @@ void spmp_store_trap(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc)
   }
 #endif /* SPMP_ENABLED */
 
-  //TODO: deal with enclave page fault
+  if(sm_enclave_page_fault(regs, mcause, read_csr(mbadaddr)) == 0)
+    return;
+
   printm("M mode: store_page_fault, badaddr: 0x%lx, badepc: 0x%lx\r\n", read_csr(mbadaddr), read_csr(mepc));
   bad_trap(regs, mcause, mepc);
 }
@@ -356,7 +635,7 @@ void poweroff(uint16_t code)
   if (htif) {
     htif_poweroff();
   } else {
-    send_ipi_many(0, IPI_HALT);
+    send_ipi_many(NULL, IPI_HALT, NULL);
     while (1) { asm volatile ("wfi\n"); }
   }
 }
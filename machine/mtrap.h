@@ -4,8 +4,11 @@
 #include "encoding.h"
 
 #ifdef __riscv_atomic
-# define MAX_HARTS 8 // arbitrary
+# ifndef MAX_HARTS
+#  define MAX_HARTS 8 // arbitrary, build with -DMAX_HARTS=n for more
+# endif
 #else
+# undef MAX_HARTS
 # define MAX_HARTS 1
 #endif
 
@@ -14,6 +17,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdarg.h>
+#include "atomic.h"
 
 #define read_const_csr(reg) ({ unsigned long __tmp; \
   asm ("csrr %0, " #reg : "=r"(__tmp)); \
@@ -37,6 +41,8 @@ extern size_t plic_ndevs;
 typedef struct {
   volatile uint32_t* ipi;
   volatile int mipi_pending;
+  // set by the SM while an enclave runs, tested by trap_vector
+  volatile int in_enclave;
 
   volatile uint64_t* timecmp;
 
@@ -44,6 +50,21 @@ typedef struct {
   volatile uintptr_t* plic_m_ie;
   volatile uint32_t* plic_s_thresh;
   volatile uintptr_t* plic_s_ie;
+
+  // remote sfence.vma pending on this hart, merged from all senders
+  spinlock_t sfence_lock;
+  volatile int sfence_pending;
+  uintptr_t sfence_start;
+  uintptr_t sfence_end;
+  uintptr_t sfence_asid;
+  volatile uintptr_t sfence_queued;
+  volatile uintptr_t sfence_done;
+
+  // SBI HSM state, start_addr and opaque are valid once start_ready is set
+  volatile int hsm_state;
+  volatile int hsm_start_ready;
+  uintptr_t hsm_start_addr;
+  uintptr_t hsm_opaque;
 } hls_t;
 
 #define MACHINE_STACK_TOP() ({ \
@@ -60,11 +81,14 @@ void poweroff(uint16_t code) __attribute((noreturn));
 void printm(const char* s, ...);
 void vprintm(const char *s, va_list args);
 void putstring(const char* s);
+void flush_pending_sfence_vma();
 #define assert(x) ({ if (!(x)) die("assertion failed: %s", #x); })
 #define die(str, ...) ({ printm("%s:%d: " str "\n", __FILE__, __LINE__, ##__VA_ARGS__); poweroff(-1); })
 
 void enter_supervisor_mode(void (*fn)(uintptr_t), uintptr_t arg0, uintptr_t arg1)
   __attribute__((noreturn));
+void restart_supervisor_mode(void (*fn)(uintptr_t), uintptr_t arg0, uintptr_t arg1)
+  __attribute__((noreturn));
 void boot_loader(uintptr_t dtb);
 void boot_other_hart(uintptr_t dtb);
 
@@ -90,13 +114,15 @@ static inline void wfi()
 #define MENTRY_FRAME_SIZE (MENTRY_HLS_OFFSET + HLS_SIZE)
 #define MENTRY_IPI_OFFSET (MENTRY_HLS_OFFSET)
 #define MENTRY_IPI_PENDING_OFFSET (MENTRY_HLS_OFFSET + REGBYTES)
+#define MENTRY_IN_ENCLAVE_OFFSET (MENTRY_HLS_OFFSET + REGBYTES + 4)
+#define MENTRY_TIMECMP_OFFSET (MENTRY_HLS_OFFSET + REGBYTES + 8)
 
 #ifdef __riscv_flen
 # define SOFT_FLOAT_CONTEXT_SIZE 0
 #else
 # define SOFT_FLOAT_CONTEXT_SIZE (8 * 32)
 #endif
-#define HLS_SIZE 64
+#define HLS_SIZE 128
 #define INTEGER_CONTEXT_SIZE (32 * REGBYTES)
 
 #endif
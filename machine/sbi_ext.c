@@ -0,0 +1,140 @@
+#include "sbi_ext.h"
+#include "mcall.h"
+#include "mtrap.h"
+#include <errno.h>
+
+// open addressing on a power of 2, well above the number of extensions
+#define SBI_EXT_SLOTS 32
+
+static const struct sbi_ext* sbi_exts[SBI_EXT_SLOTS];
+static sbi_fn_t sbi_legacy_fns[SBI_LEGACY_NR];
+
+static uintptr_t sbi_ext_hash(uintptr_t eid)
+{
+  return (eid ^ (eid >> 8) ^ (eid >> 16) ^ (eid >> 24)) & (SBI_EXT_SLOTS - 1);
+}
+
+static const struct sbi_ext* sbi_find_ext(uintptr_t eid)
+{
+  uintptr_t slot = sbi_ext_hash(eid);
+
+  for (uintptr_t i = 0; i < SBI_EXT_SLOTS && sbi_exts[slot]; i++) {
+    if (sbi_exts[slot]->eid == eid)
+      return sbi_exts[slot];
+    slot = (slot + 1) & (SBI_EXT_SLOTS - 1);
+  }
+  return NULL;
+}
+
+int sbi_register_ext(const struct sbi_ext* ext)
+{
+  uintptr_t slot = sbi_ext_hash(ext->eid);
+
+  for (uintptr_t i = 0; i < SBI_EXT_SLOTS; i++) {
+    if (!sbi_exts[slot] || sbi_exts[slot]->eid == ext->eid) {
+      sbi_exts[slot] = ext;
+      return 0;
+    }
+    slot = (slot + 1) & (SBI_EXT_SLOTS - 1);
+  }
+
+  printm("sbi: no slot for extension %lx\r\n", ext->eid);
+  return -1;
+}
+
+int sbi_register_legacy(uintptr_t eid, sbi_fn_t fn)
+{
+  if (eid >= SBI_LEGACY_NR)
+    return -1;
+  sbi_legacy_fns[eid] = fn;
+  return 0;
+}
+
+int sbi_probe_ext(uintptr_t eid)
+{
+  if (sbi_find_ext(eid))
+    return 1;
+  return eid < SBI_LEGACY_NR && sbi_legacy_fns[eid];
+}
+
+void sbi_dispatch(uintptr_t* regs)
+{
+  uintptr_t eid = regs[17], fid = regs[16];
+  const struct sbi_ext* ext = sbi_find_ext(eid);
+  sbi_fn_t fn = NULL;
+  int legacy = 0;
+  struct sbiret ret;
+
+  if (ext) {
+    fn = fid < ext->nr_fns ? ext->fns[fid] : NULL;
+    legacy = ext->flags & SBI_EXT_LEGACY_RET;
+  } else if (eid < SBI_LEGACY_NR) {
+    fn = sbi_legacy_fns[eid];
+    legacy = 1;
+  }
+
+  if (fn)
+    ret = fn(regs);
+  else if (legacy)
+    ret = SBI_RET(0, -ENOSYS);
+  else
+    ret = SBI_RET(SBI_ERR_NOT_SUPPORTED, 0);
+
+  regs[10] = legacy ? ret.value : ret.error;
+  if (!legacy)
+    regs[11] = ret.value;
+}
+
+static struct sbiret sbi_base_get_spec_version(uintptr_t* regs)
+{
+  return SBI_RET(SBI_SUCCESS, SBI_SPEC_VERSION);
+}
+
+static struct sbiret sbi_base_get_impl_id(uintptr_t* regs)
+{
+  return SBI_RET(SBI_SUCCESS, SBI_IMPL_ID_BBL);
+}
+
+static struct sbiret sbi_base_get_impl_version(uintptr_t* regs)
+{
+  return SBI_RET(SBI_SUCCESS, 0);
+}
+
+static struct sbiret sbi_base_probe_extension(uintptr_t* regs)
+{
+  return SBI_RET(SBI_SUCCESS, sbi_probe_ext(regs[10]));
+}
+
+static struct sbiret sbi_base_get_mvendorid(uintptr_t* regs)
+{
+  return SBI_RET(SBI_SUCCESS, read_csr(mvendorid));
+}
+
+static struct sbiret sbi_base_get_marchid(uintptr_t* regs)
+{
+  return SBI_RET(SBI_SUCCESS, read_csr(marchid));
+}
+
+static struct sbiret sbi_base_get_mimpid(uintptr_t* regs)
+{
+  return SBI_RET(SBI_SUCCESS, read_csr(mimpid));
+}
+
+static const sbi_fn_t sbi_base_fns[] = {
+  [SBI_EXT_BASE_GET_SPEC_VERSION] = sbi_base_get_spec_version,
+  [SBI_EXT_BASE_GET_IMPL_ID] = sbi_base_get_impl_id,
+  [SBI_EXT_BASE_GET_IMPL_VERSION] = sbi_base_get_impl_version,
+  [SBI_EXT_BASE_PROBE_EXT] = sbi_base_probe_extension,
+  [SBI_EXT_BASE_GET_MVENDORID] = sbi_base_get_mvendorid,
+  [SBI_EXT_BASE_GET_MARCHID] = sbi_base_get_marchid,
+  [SBI_EXT_BASE_GET_MIMPID] = sbi_base_get_mimpid,
+};
+
+static const struct sbi_ext sbi_base_ext = {
+  SBI_EXT_BASE, sbi_base_fns, sizeof(sbi_base_fns) / sizeof(sbi_base_fns[0]), 0
+};
+
+void sbi_ext_init()
+{
+  sbi_register_ext(&sbi_base_ext);
+}
@@ -0,0 +1,39 @@
+#ifndef _RISCV_SBI_EXT_H
+#define _RISCV_SBI_EXT_H
+
+#include <stdint.h>
+
+struct sbiret {
+  uintptr_t error;
+  uintptr_t value;
+};
+
+#define SBI_RET(error, value) ((struct sbiret){ (error), (value) })
+
+// the arguments are in regs[10..15], mepc already points past the ecall
+typedef struct sbiret (*sbi_fn_t)(uintptr_t* regs);
+
+// only value is returned, in a0, as by the v0.1 calls
+#define SBI_EXT_LEGACY_RET 0x1
+
+struct sbi_ext {
+  uintptr_t eid;
+  const sbi_fn_t* fns; // indexed by fid, NULL if not supported
+  uintptr_t nr_fns;
+  uintptr_t flags;
+};
+
+// legacy calls are numbered below this and pass no fid
+#define SBI_LEGACY_NR 128
+
+// extensions are registered on the first hart before the others are woken
+int sbi_register_ext(const struct sbi_ext* ext);
+int sbi_register_legacy(uintptr_t eid, sbi_fn_t fn);
+int sbi_probe_ext(uintptr_t eid);
+
+void sbi_ext_init();
+void sbi_dispatch(uintptr_t* regs);
+
+void sbi_init();
+
+#endif
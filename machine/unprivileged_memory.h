@@ -62,6 +62,68 @@ static inline void store_uint64_t(uint64_t* addr, uint64_t val, uintptr_t mepc)
 }
 #endif
 
+// Load len <= sizeof(uintptr_t) bytes at a misaligned addr, from the two
+// aligned words covering them in a single MPRV window
+static inline uintptr_t load_misaligned(uintptr_t addr, int len, uintptr_t mepc)
+{
+  register uintptr_t __mepc asm ("a2") = mepc;
+  register uintptr_t __mstatus asm ("a3");
+  uintptr_t lo, hi, val;
+  uintptr_t shift = 8 * (addr & (sizeof(uintptr_t) - 1));
+
+  asm ("csrrs %[mstatus], mstatus, %[mprv]\n"
+       STR(LOAD) " %[lo], (%[lo_addr])\n"
+       STR(LOAD) " %[hi], (%[hi_addr])\n"
+       "csrw mstatus, %[mstatus]"
+       : [mstatus] "+&r" (__mstatus), [lo] "=&r" (lo), [hi] "=&r" (hi)
+       : [mprv] "r" (MSTATUS_MPRV), [mepc] "r" (__mepc),
+         [lo_addr] "r" (addr & -sizeof(uintptr_t)),
+         [hi_addr] "r" ((addr + len - 1) & -sizeof(uintptr_t)));
+
+  val = (lo >> shift) | (hi << (8 * sizeof(uintptr_t) - 1 - shift) << 1);
+  if (len < sizeof(uintptr_t))
+    val &= (1UL << (8 * len)) - 1;
+  return val;
+}
+
+// Store the low len <= sizeof(uintptr_t) bytes of val at a misaligned addr
+// in a single MPRV window. Only those bytes are written, as the largest
+// aligned pieces, so stores of other harts next to them are not lost.
+static inline void store_misaligned(uintptr_t addr, uintptr_t val, int len, uintptr_t mepc)
+{
+  register uintptr_t __mepc asm ("a2") = mepc;
+  register uintptr_t __mstatus asm ("a3");
+  uintptr_t tmp, n = len;
+
+  asm volatile ("csrrs %[mstatus], mstatus, %[mprv]\n"
+                "1: andi %[tmp], %[addr], 1\n"
+                "bnez %[tmp], 2f\n"
+                "sltiu %[tmp], %[n], 2\n"
+                "bnez %[tmp], 2f\n"
+                "andi %[tmp], %[addr], 2\n"
+                "bnez %[tmp], 3f\n"
+                "sltiu %[tmp], %[n], 4\n"
+                "bnez %[tmp], 3f\n"
+                "sw %[val], (%[addr])\n"
+                "li %[tmp], 4\n"
+                "j 4f\n"
+                "2: sb %[val], (%[addr])\n"
+                "li %[tmp], 1\n"
+                "j 4f\n"
+                "3: sh %[val], (%[addr])\n"
+                "li %[tmp], 2\n"
+                "4: add %[addr], %[addr], %[tmp]\n"
+                "sub %[n], %[n], %[tmp]\n"
+                "slli %[tmp], %[tmp], 3\n"
+                "srl %[val], %[val], %[tmp]\n"
+                "bnez %[n], 1b\n"
+                "csrw mstatus, %[mstatus]"
+                : [mstatus] "+&r" (__mstatus), [addr] "+&r" (addr), [val] "+&r" (val),
+                  [n] "+&r" (n), [tmp] "=&r" (tmp)
+                : [mprv] "r" (MSTATUS_MPRV), [mepc] "r" (__mepc)
+                : "memory");
+}
+
 static uintptr_t __attribute__((always_inline)) get_insn(uintptr_t mepc, uintptr_t* mstatus)
 {
   register uintptr_t __mepc asm ("a2") = mepc;
@@ -3,11 +3,12 @@
 #include "boot.h"
 #include "elf.h"
 #include "mtrap.h"
+#include "disabled_hart_mask.h"
 #include "frontend.h"
 #include <stdbool.h>
 
 elf_info current;
-long disabled_hart_mask;
+hartmask_t disabled_hart_mask;
 
 static void handle_option(const char* s)
 {
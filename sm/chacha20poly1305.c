@@ -0,0 +1,253 @@
+#include "chacha20poly1305.h"
+#include <string.h>
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) do { \
+  a += b; d ^= a; d = ROTL32(d, 16); \
+  c += d; b ^= c; b = ROTL32(b, 12); \
+  a += b; d ^= a; d = ROTL32(d, 8); \
+  c += d; b ^= c; b = ROTL32(b, 7); \
+} while(0)
+
+#define POLY1305_MASK44 0xfffffffffffULL
+#define POLY1305_MASK42 0x3ffffffffffULL
+
+static uint32_t load32_le(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t load64_le(const uint8_t* p)
+{
+  return (uint64_t)load32_le(p) | ((uint64_t)load32_le(p + 4) << 32);
+}
+
+static void store32_le(uint8_t* p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static void store64_le(uint8_t* p, uint64_t v)
+{
+  store32_le(p, (uint32_t)v);
+  store32_le(p + 4, (uint32_t)(v >> 32));
+}
+
+void chacha20_block(const uint8_t key[CHACHA20_KEY_SIZE], uint32_t counter,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], uint8_t out[CHACHA20_BLOCK_SIZE])
+{
+  uint32_t in[16], x[16];
+  int i;
+
+  in[0] = 0x61707865;
+  in[1] = 0x3320646e;
+  in[2] = 0x79622d32;
+  in[3] = 0x6b206574;
+  for(i = 0; i < 8; ++i)
+    in[4 + i] = load32_le(key + 4 * i);
+  in[12] = counter;
+  for(i = 0; i < 3; ++i)
+    in[13 + i] = load32_le(nonce + 4 * i);
+
+  memcpy(x, in, sizeof(x));
+  for(i = 0; i < 10; ++i)
+  {
+    QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+    QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+    QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+    QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+    QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+    QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+    QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+    QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+  }
+
+  for(i = 0; i < 16; ++i)
+    store32_le(out + 4 * i, x[i] + in[i]);
+}
+
+void chacha20_xor(const uint8_t key[CHACHA20_KEY_SIZE], uint32_t counter,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], uint8_t* dst, const uint8_t* src, unsigned long len)
+{
+  uint8_t stream[CHACHA20_BLOCK_SIZE];
+  unsigned long off, i, n;
+
+  for(off = 0; off < len; off += CHACHA20_BLOCK_SIZE)
+  {
+    chacha20_block(key, counter++, nonce, stream);
+    n = len - off < CHACHA20_BLOCK_SIZE ? len - off : CHACHA20_BLOCK_SIZE;
+    for(i = 0; i < n; ++i)
+      dst[off + i] = src[off + i] ^ stream[i];
+  }
+
+  memset(stream, 0, sizeof(stream));
+}
+
+//poly1305 with 44/44/42-bit limbs, after poly1305-donna
+struct poly1305_t
+{
+  uint64_t r[3];
+  uint64_t h[3];
+  uint64_t pad[2];
+};
+
+static void poly1305_init(struct poly1305_t* st, const uint8_t key[32])
+{
+  uint64_t t0 = load64_le(key);
+  uint64_t t1 = load64_le(key + 8);
+
+  //r is clamped as required by the spec
+  st->r[0] = t0 & 0xffc0fffffffULL;
+  st->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+  st->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+  st->h[0] = 0;
+  st->h[1] = 0;
+  st->h[2] = 0;
+  st->pad[0] = load64_le(key + 16);
+  st->pad[1] = load64_le(key + 24);
+}
+
+static void poly1305_block(struct poly1305_t* st, const uint8_t m[16])
+{
+  uint64_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+  uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+  uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint64_t t0 = load64_le(m), t1 = load64_le(m + 8);
+  unsigned __int128 d0, d1, d2;
+  uint64_t c;
+
+  h0 += t0 & POLY1305_MASK44;
+  h1 += ((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44;
+  h2 += ((t1 >> 24) & POLY1305_MASK42) | (1ULL << 40);
+
+  d0 = (unsigned __int128)h0 * r0 + (unsigned __int128)h1 * s2 + (unsigned __int128)h2 * s1;
+  d1 = (unsigned __int128)h0 * r1 + (unsigned __int128)h1 * r0 + (unsigned __int128)h2 * s2;
+  d2 = (unsigned __int128)h0 * r2 + (unsigned __int128)h1 * r1 + (unsigned __int128)h2 * r0;
+
+  c = (uint64_t)(d0 >> 44);
+  h0 = (uint64_t)d0 & POLY1305_MASK44;
+  d1 += c;
+  c = (uint64_t)(d1 >> 44);
+  h1 = (uint64_t)d1 & POLY1305_MASK44;
+  d2 += c;
+  c = (uint64_t)(d2 >> 42);
+  h2 = (uint64_t)d2 & POLY1305_MASK42;
+  h0 += c * 5;
+  c = h0 >> 44;
+  h0 &= POLY1305_MASK44;
+  h1 += c;
+
+  st->h[0] = h0;
+  st->h[1] = h1;
+  st->h[2] = h2;
+}
+
+//feed data zero padded to a multiple of 16 bytes, as the AEAD does
+static void poly1305_update_padded(struct poly1305_t* st, const uint8_t* m, unsigned long len)
+{
+  uint8_t block[16];
+
+  for(; len >= 16; m += 16, len -= 16)
+    poly1305_block(st, m);
+
+  if(len)
+  {
+    memset(block, 0, sizeof(block));
+    memcpy(block, m, len);
+    poly1305_block(st, block);
+  }
+}
+
+static void poly1305_finish(struct poly1305_t* st, uint8_t tag[POLY1305_TAG_SIZE])
+{
+  uint64_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  uint64_t g0, g1, g2, c, t0, t1;
+
+  //fully carry h
+  c = h1 >> 44; h1 &= POLY1305_MASK44;
+  h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+  h0 += c * 5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+  h1 += c; c = h1 >> 44; h1 &= POLY1305_MASK44;
+  h2 += c; c = h2 >> 42; h2 &= POLY1305_MASK42;
+  h0 += c * 5; c = h0 >> 44; h0 &= POLY1305_MASK44;
+  h1 += c;
+
+  //compute h - p and select it in constant time if h >= p
+  g0 = h0 + 5; c = g0 >> 44; g0 &= POLY1305_MASK44;
+  g1 = h1 + c; c = g1 >> 44; g1 &= POLY1305_MASK44;
+  g2 = h2 + c - (1ULL << 42);
+
+  c = (g2 >> 63) - 1;
+  g0 &= c;
+  g1 &= c;
+  g2 &= c;
+  c = ~c;
+  h0 = (h0 & c) | g0;
+  h1 = (h1 & c) | g1;
+  h2 = (h2 & c) | g2;
+
+  //h + pad mod 2^128
+  t0 = st->pad[0];
+  t1 = st->pad[1];
+  h0 += t0 & POLY1305_MASK44; c = h0 >> 44; h0 &= POLY1305_MASK44;
+  h1 += (((t0 >> 44) | (t1 << 20)) & POLY1305_MASK44) + c; c = h1 >> 44; h1 &= POLY1305_MASK44;
+  h2 += ((t1 >> 24) & POLY1305_MASK42) + c; h2 &= POLY1305_MASK42;
+
+  store64_le(tag, h0 | (h1 << 44));
+  store64_le(tag + 8, (h1 >> 20) | (h2 << 24));
+
+  memset(st, 0, sizeof(*st));
+}
+
+static void chacha20poly1305_tag(const uint8_t key[CHACHA20_KEY_SIZE],
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], const uint8_t* aad, unsigned long aad_len,
+    const uint8_t* ct, unsigned long len, uint8_t tag[POLY1305_TAG_SIZE])
+{
+  struct poly1305_t st;
+  uint8_t block[CHACHA20_BLOCK_SIZE];
+  uint8_t lens[16];
+
+  //the one-time poly1305 key is the first half of block 0
+  chacha20_block(key, 0, nonce, block);
+  poly1305_init(&st, block);
+  memset(block, 0, sizeof(block));
+
+  poly1305_update_padded(&st, aad, aad_len);
+  poly1305_update_padded(&st, ct, len);
+  store64_le(lens, aad_len);
+  store64_le(lens + 8, len);
+  poly1305_block(&st, lens);
+  poly1305_finish(&st, tag);
+}
+
+void chacha20poly1305_encrypt(const uint8_t key[CHACHA20_KEY_SIZE],
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], const uint8_t* aad, unsigned long aad_len,
+    uint8_t* dst, const uint8_t* src, unsigned long len, uint8_t tag[POLY1305_TAG_SIZE])
+{
+  chacha20_xor(key, 1, nonce, dst, src, len);
+  chacha20poly1305_tag(key, nonce, aad, aad_len, dst, len, tag);
+}
+
+int chacha20poly1305_decrypt(const uint8_t key[CHACHA20_KEY_SIZE],
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], const uint8_t* aad, unsigned long aad_len,
+    uint8_t* dst, const uint8_t* src, unsigned long len, const uint8_t tag[POLY1305_TAG_SIZE])
+{
+  uint8_t expected[POLY1305_TAG_SIZE];
+  uint8_t diff = 0;
+  int i;
+
+  chacha20poly1305_tag(key, nonce, aad, aad_len, src, len, expected);
+
+  //compare in constant time
+  for(i = 0; i < POLY1305_TAG_SIZE; ++i)
+    diff |= expected[i] ^ tag[i];
+  if(diff)
+    return -1;
+
+  chacha20_xor(key, 1, nonce, dst, src, len);
+  return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef _CHACHA20POLY1305_H
+#define _CHACHA20POLY1305_H
+
+#include <stdint.h>
+
+/*
+ * ChaCha20-Poly1305 AEAD as specified in RFC 8439.
+ * Plain C so that it runs on harts without any crypto extension.
+ */
+#define CHACHA20_KEY_SIZE     32
+#define CHACHA20_NONCE_SIZE   12
+#define CHACHA20_BLOCK_SIZE   64
+#define POLY1305_TAG_SIZE     16
+
+void chacha20_block(const uint8_t key[CHACHA20_KEY_SIZE], uint32_t counter,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], uint8_t out[CHACHA20_BLOCK_SIZE]);
+
+//dst and src may be the same buffer
+void chacha20_xor(const uint8_t key[CHACHA20_KEY_SIZE], uint32_t counter,
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], uint8_t* dst, const uint8_t* src, unsigned long len);
+
+void chacha20poly1305_encrypt(const uint8_t key[CHACHA20_KEY_SIZE],
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], const uint8_t* aad, unsigned long aad_len,
+    uint8_t* dst, const uint8_t* src, unsigned long len, uint8_t tag[POLY1305_TAG_SIZE]);
+
+//the tag is checked before anything is decrypted, return -1 if it mismatches
+int chacha20poly1305_decrypt(const uint8_t key[CHACHA20_KEY_SIZE],
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], const uint8_t* aad, unsigned long aad_len,
+    uint8_t* dst, const uint8_t* src, unsigned long len, const uint8_t tag[POLY1305_TAG_SIZE]);
+
+#endif /* _CHACHA20POLY1305_H */
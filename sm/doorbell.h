@@ -0,0 +1,64 @@
+#ifndef _DOORBELL_H
+#define _DOORBELL_H
+
+/*
+ * Doorbell ring of an exclusive enclave hart
+ *
+ * An enclave started with SBI_RUN_ENCLAVE_EXCLUSIVE keeps its hart until
+ * it exits: timer irqs are not forwarded and there is no host to serve
+ * synchronous ocalls. The host dispatches work to it through this ring,
+ * placed right after the ocall ring in the untrusted memory
+ * (untrusted_ptr + OCALL_RING_SIZE), and ocalls go through the
+ * exitless ocall ring.
+ *
+ * Host (producer):
+ *   slot = ring->head % DOORBELL_RING_SLOTS
+ *   wait until slots[slot].state == DOORBELL_SLOT_FREE
+ *   fill func_id/arg0/arg1, fence
+ *   slots[slot].state = DOORBELL_SLOT_POSTED, ring->head++
+ *   ring->doorbell++
+ *   later: wait until slots[slot].state == DOORBELL_SLOT_DONE,
+ *   read retval, slots[slot].state = DOORBELL_SLOT_FREE
+ *
+ * Enclave (consumer):
+ *   spin until ring->doorbell changes or ring->tail != ring->head
+ *   slot = ring->tail % DOORBELL_RING_SLOTS
+ *   serve the request, fill retval, fence
+ *   slots[slot].state = DOORBELL_SLOT_DONE, ring->tail++
+ *
+ * The enclave leaves its hart by SBI_EXIT_ENCLAVE once the host posts
+ * DOORBELL_FUNC_EXIT.
+ */
+
+#define DOORBELL_RING_MAGIC     0x44424c52UL
+#define DOORBELL_RING_SLOTS     64
+
+//state of a doorbell slot
+#define DOORBELL_SLOT_FREE      0
+#define DOORBELL_SLOT_POSTED    1
+#define DOORBELL_SLOT_DONE      2
+
+//reserved function id: ask the enclave to exit and give the hart back
+#define DOORBELL_FUNC_EXIT      0xffffUL
+
+struct doorbell_req_t
+{
+  volatile unsigned long state;
+  unsigned long func_id;
+  unsigned long arg0;
+  unsigned long arg1;
+  unsigned long retval;
+};
+
+struct doorbell_ring_t
+{
+  unsigned long magic;
+  volatile unsigned long head;
+  volatile unsigned long tail;
+  volatile unsigned long doorbell;
+  struct doorbell_req_t slots[DOORBELL_RING_SLOTS];
+};
+
+#define DOORBELL_RING_SIZE (sizeof(struct doorbell_ring_t))
+
+#endif /* _DOORBELL_H */
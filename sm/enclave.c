@@ -1,6 +1,12 @@
 #include "enclave.h"
+#include "enclave_vm.h"
+#include "shm.h"
+#include "relay_page.h"
+#include "run_queue.h"
+#include "timer.h"
 #include "sm.h"
 #include "math.h"
+#include "fdt.h"
 #include <string.h>
 #include TARGET_PLATFORM_HEADER
 
@@ -31,10 +37,13 @@ int copy_word_to_host(unsigned int* ptr, uintptr_t value)
   return 0;
 }
 
-static void enter_enclave_world(int eid)
+static void enter_enclave_world(int eid, int tid)
 {
   cpus[read_csr(mhartid)].in_enclave = 1;
   cpus[read_csr(mhartid)].eid = eid;
+  cpus[read_csr(mhartid)].tid = tid;
+  //lets trap_vector send timer irqs to handle_timer_irq
+  HLS()->in_enclave = 1;
 
   platform_enter_enclave_world();
 }
@@ -44,14 +53,40 @@ static int get_enclave_id()
   return cpus[read_csr(mhartid)].eid;
 }
 
+static int get_thread_id()
+{
+  return cpus[read_csr(mhartid)].tid;
+}
+
 static void exit_enclave_world()
 {
   cpus[read_csr(mhartid)].in_enclave = 0;
   cpus[read_csr(mhartid)].eid = -1;
+  cpus[read_csr(mhartid)].tid = -1;
+  cpus[read_csr(mhartid)].exclusive = 0;
+  HLS()->in_enclave = 0;
 
   platform_exit_enclave_world();
 }
 
+static int check_exclusive_hart()
+{
+  return cpus[read_csr(mhartid)].exclusive;
+}
+
+//harts parked in an enclave by run_enclave_exclusive
+void get_exclusive_hart_mask(hartmask_t* mask)
+{
+  int i;
+
+  hartmask_zero(mask);
+  for(i = 0; i < MAX_HARTS; ++i)
+  {
+    if(cpus[i].in_enclave && cpus[i].exclusive)
+      hartmask_set(mask, i);
+  }
+}
+
 int check_in_enclave_world()
 {
   if(!(cpus[read_csr(mhartid)].in_enclave))
@@ -63,9 +98,9 @@ int check_in_enclave_world()
   return 0;
 }
 
-static int check_enclave_authentication()
+static int check_enclave_authentication(struct enclave_t* enclave)
 {
-  if(platform_check_enclave_authentication() < 0)
+  if(platform_check_enclave_authentication(enclave) < 0)
     return -1;
 
   return 0;
@@ -252,14 +287,13 @@ static int free_enclave(int eid)
   return ret_val;
 }
 
-struct enclave_t* get_enclave(int eid)
+//remember to acquire enclave_metadata_lock before calling this function
+static struct enclave_t* __get_enclave(int eid)
 {
   struct link_mem_t *cur, *next;
   struct enclave_t *enclave;
   int i, found, count;
 
-  spinlock_lock(&enclave_metadata_lock);
-
   found = 0;
   count = 0;
   for(cur = enclave_metadata_head; cur != NULL; cur = cur->next_link_mem)
@@ -281,41 +315,116 @@ struct enclave_t* get_enclave(int eid)
     enclave = NULL;
   }
 
+  return enclave;
+}
+
+struct enclave_t* get_enclave(int eid)
+{
+  struct enclave_t *enclave;
+
+  spinlock_lock(&enclave_metadata_lock);
+  enclave = __get_enclave(eid);
   spinlock_unlock(&enclave_metadata_lock);
+
   return enclave;
 }
 
-int swap_from_host_to_enclave(uintptr_t* host_regs, struct enclave_t* enclave)
+/*
+ * A thread that is in the middle of an enclave-to-enclave call has
+ * handed the host context to thread0 of its callee, so the host has to
+ * be served by the innermost callee of the chain.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+static struct enclave_t* get_active_callee(struct enclave_t* enclave, int* tid)
+{
+  while(enclave && enclave->threads[*tid].callee_eid >= 0)
+  {
+    enclave = __get_enclave(enclave->threads[*tid].callee_eid);
+    *tid = 0;
+  }
+
+  return enclave;
+}
+
+//remember to acquire enclave_metadata_lock before calling this function
+static int count_enclave_threads(struct enclave_t* enclave, enclave_state_t state)
+{
+  int tid, count = 0;
+
+  for(tid = 0; tid < ENCLAVE_MAX_THREADS; ++tid)
+  {
+    if(enclave->threads[tid].state == state)
+      count++;
+  }
+
+  return count;
+}
+
+/*
+ * Memory attached to or detached from an enclave is only reloaded into
+ * the sPMP of the current hart, so other threads must not be running.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+static int check_single_running_thread(struct enclave_t* enclave)
+{
+  if(count_enclave_threads(enclave, RUNNING) > 1)
+    return -1;
+
+  return 0;
+}
+
+//enclaves scheduled by the security monitor run for a time slice at a time
+static void start_time_slice(struct enclave_t* enclave)
+{
+  if(enclave->time_slice)
+    timer_set(TIMER_QUANTUM, *mtime + enclave->time_slice);
+  else
+    timer_set(TIMER_QUANTUM, TIMER_NONE);
+}
+
+//tell the host which thread is switched out when the SM schedules enclaves
+static void report_switched_thread(uintptr_t* regs, struct enclave_t* enclave, int tid)
 {
+  if(!enclave->time_slice)
+    return;
+
+  regs[11] = enclave->eid;
+  regs[12] = tid;
+}
+
+int swap_from_host_to_enclave(uintptr_t* host_regs, struct enclave_t* enclave, int tid)
+{
+  struct thread_state_t* thread = &(enclave->threads[tid].context);
+
   //grant encalve access to memory
   if(grant_enclave_access(enclave) < 0)
     return -1;
 
   //save host context
-  swap_prev_state(&(enclave->thread_context), host_regs);
+  swap_prev_state(thread, host_regs);
 
   //different platforms have differnt ptbr switch methods
-  switch_to_enclave_ptbr(&(enclave->thread_context), enclave->thread_context.encl_ptbr);
+  switch_to_enclave_ptbr(thread, thread->encl_ptbr);
 
   //save host trap vector
-  swap_prev_stvec(&(enclave->thread_context), read_csr(stvec));
+  swap_prev_stvec(thread, read_csr(stvec));
 
   //TODO: save host cache binding
   //swap_prev_cache_binding(&enclave -> threads[0], read_csr(0x356));
 
   //disable interrupts
-  swap_prev_mie(&(enclave->thread_context), read_csr(mie));
+  swap_prev_mie(thread, read_csr(mie));
   clear_csr(mip, MIP_MTIP);
   clear_csr(mip, MIP_STIP);
   clear_csr(mip, MIP_SSIP);
   clear_csr(mip, MIP_SEIP);
 
   //disable interrupts/exceptions delegation
-  swap_prev_mideleg(&(enclave->thread_context), read_csr(mideleg));
-  swap_prev_medeleg(&(enclave->thread_context), read_csr(medeleg));
+  swap_prev_mideleg(thread, read_csr(mideleg));
+  swap_prev_medeleg(thread, read_csr(medeleg));
 
   //swap the mepc to transfer control to the enclave
-  swap_prev_mepc(&(enclave->thread_context), read_csr(mepc)); 
+  swap_prev_mepc(thread, read_csr(mepc)); 
 
   //set mstatus to transfer control to u mode
   uintptr_t mstatus = read_csr(mstatus);
@@ -323,45 +432,60 @@ int swap_from_host_to_enclave(uintptr_t* host_regs, struct enclave_t* enclave)
   write_csr(mstatus, mstatus);
 
   //mark that cpu is in enclave world now
-  enter_enclave_world(enclave->eid);
+  enter_enclave_world(enclave->eid, tid);
+  enclave->threads[tid].hart = read_csr(mhartid);
+
+  //the host deadline is kept in the timer queue while the enclave runs
+  timer_set(TIMER_HOST, *HLS()->timecmp);
+  timer_set(TIMER_ENCLAVE, enclave->threads[tid].timer_deadline);
+  start_time_slice(enclave);
+  timer_program();
 
   __asm__ __volatile__ ("sfence.vma" : : : "memory");
 
   return 0;
 }
 
-int swap_from_enclave_to_host(uintptr_t* regs, struct enclave_t* enclave)
+int swap_from_enclave_to_host(uintptr_t* regs, struct enclave_t* enclave, int tid)
 {
+  struct thread_state_t* thread = &(enclave->threads[tid].context);
+
   //retrieve enclave access to memory
   retrieve_enclave_access(enclave);
 
   //restore host context
-  swap_prev_state(&(enclave->thread_context), regs);
+  swap_prev_state(thread, regs);
 
   //restore host's ptbr
-  switch_to_host_ptbr(&(enclave->thread_context), enclave->host_ptbr);
+  switch_to_host_ptbr(thread, enclave->host_ptbr);
 
   //restore host stvec
-  swap_prev_stvec(&(enclave->thread_context), read_csr(stvec));
+  swap_prev_stvec(thread, read_csr(stvec));
 
   //TODO: restore host cache binding
-  //swap_prev_cache_binding(&(enclave->thread_context), );
+  //swap_prev_cache_binding(thread, );
   
   //restore interrupts
-  swap_prev_mie(&(enclave->thread_context), read_csr(mie));
+  swap_prev_mie(thread, read_csr(mie));
 
   //restore interrupts/exceptions delegation
-  swap_prev_mideleg(&(enclave->thread_context), read_csr(mideleg));
-  swap_prev_medeleg(&(enclave->thread_context), read_csr(medeleg));
+  swap_prev_mideleg(thread, read_csr(mideleg));
+  swap_prev_medeleg(thread, read_csr(medeleg));
 
   //transfer control back to kernel
-  swap_prev_mepc(&(enclave->thread_context), read_csr(mepc));
+  swap_prev_mepc(thread, read_csr(mepc));
 
   //restore mstatus
   uintptr_t mstatus = read_csr(mstatus);
   mstatus = INSERT_FIELD(mstatus, MSTATUS_MPP, PRV_S);
   write_csr(mstatus, mstatus);
 
+  //save the thread's own deadline, timecmp belongs to the host again
+  enclave->threads[tid].timer_deadline = timer_get(TIMER_ENCLAVE);
+  timer_set(TIMER_QUANTUM, TIMER_NONE);
+  timer_set(TIMER_ENCLAVE, TIMER_NONE);
+  timer_program();
+
   //mark that cpu is out of enclave world now
   exit_enclave_world();
 
@@ -373,6 +497,7 @@ int swap_from_enclave_to_host(uintptr_t* regs, struct enclave_t* enclave)
 uintptr_t create_enclave(struct enclave_sbi_param_t create_args)
 {
   struct enclave_t* enclave;
+  int i;
 
   enclave = alloc_enclave();
   if(!enclave)
@@ -382,7 +507,6 @@ uintptr_t create_enclave(struct enclave_sbi_param_t create_args)
   }
 
   //TODO: check whether enclave memory is out of bound
-  //TODO: verify enclave page table layout
 
   spinlock_lock(&enclave_metadata_lock);
 
@@ -397,9 +521,28 @@ uintptr_t create_enclave(struct enclave_sbi_param_t create_args)
   enclave->ocall_arg1 = create_args.ecall_arg2;
   enclave->ocall_syscall_num = create_args.ecall_arg3;
   enclave->host_ptbr = read_csr(satp);
-  enclave->thread_context.encl_ptbr = (create_args.paddr >> (RISCV_PGSHIFT) | SATP_MODE_CHOICE);
   enclave->root_page_table = (unsigned long*)create_args.paddr;
+  for(i = 0; i < ENCLAVE_MAX_THREADS; ++i)
+  {
+    enclave->threads[i].state = INVALID;
+    enclave->threads[i].callee_eid = -1;
+    enclave->threads[i].hart = -1;
+    enclave->threads[i].timer_deadline = TIMER_NONE;
+    enclave->threads[i].context.encl_ptbr = (create_args.paddr >> (RISCV_PGSHIFT) | SATP_MODE_CHOICE);
+  }
+  enclave->caller_eid = -1;
+  enclave->caller_tid = -1;
+  enclave->shm_id = -1;
   enclave->state = FRESH;
+
+  if(enclave_verify_page_table(enclave) < 0)
+  {
+    printm("M mode: create_enclave: invalid enclave page table\r\n");
+    enclave->state = INVALID;
+    spinlock_unlock(&enclave_metadata_lock);
+    free_enclave(enclave->eid);
+    return -1UL;
+  }
   
   spinlock_unlock(&enclave_metadata_lock);
 
@@ -408,23 +551,33 @@ uintptr_t create_enclave(struct enclave_sbi_param_t create_args)
   return 0;
 }
 
-uintptr_t run_enclave(uintptr_t* regs, unsigned int eid)
+/*
+ * Start thread tid of an enclave on current hart. Threads can be started
+ * while other threads of the same enclave are running on other harts.
+ */
+uintptr_t run_enclave(uintptr_t* regs, unsigned int eid, unsigned int tid)
 {
   struct enclave_t* enclave;
   uintptr_t retval = 0;
 
   enclave = get_enclave(eid);
-  if(!enclave)
+  if(!enclave || tid >= ENCLAVE_MAX_THREADS)
   {
-    printm("M mode: run_enclave: wrong enclave id\r\n");
+    printm("M mode: run_enclave: wrong enclave id or thread id\r\n");
     return -1UL;
   }
 
   spinlock_lock(&enclave_metadata_lock);
 
-  if(enclave->state != FRESH)
+  if((enclave->state != FRESH && enclave->state != RUNNING) || enclave->caller_eid >= 0)
   {
-    printm("M mode: run_enclave: enclave is not initialized or already used\r\n");
+    printm("M mode: run_enclave: enclave is not initialized or can not be run\r\n");
+    retval = -1UL;
+    goto run_enclave_out;
+  }
+  if(enclave->threads[tid].state != INVALID)
+  {
+    printm("M mode: run_enclave: thread%d of enclave%d is already used\r\n", tid, eid);
     retval = -1UL;
     goto run_enclave_out;
   }
@@ -434,7 +587,7 @@ uintptr_t run_enclave(uintptr_t* regs, unsigned int eid)
     retval = -1UL;
     goto run_enclave_out;
   }
-  if(swap_from_host_to_enclave(regs, enclave) < 0)
+  if(swap_from_host_to_enclave(regs, enclave, tid) < 0)
   {
     printm("M mode: run_enclave: enclave can not be run\r\n");
     retval = -1UL;
@@ -447,14 +600,16 @@ uintptr_t run_enclave(uintptr_t* regs, unsigned int eid)
   //TODO: enable timer interrupt
   set_csr(mie, MIP_MTIP);
 
-  //set default stack
-  regs[2] = ENCLAVE_DEFAULT_STACK;
+  //every thread has its own stack
+  regs[2] = ENCLAVE_DEFAULT_STACK - tid * ENCLAVE_THREAD_STACK_SIZE;
 
   //pass parameters
   regs[11] = (uintptr_t)enclave->entry_point;
   regs[12] = (uintptr_t)enclave->untrusted_ptr;
   regs[13] = (uintptr_t)enclave->untrusted_size;
+  regs[17] = (uintptr_t)tid;
 
+  enclave->threads[tid].state = RUNNING;
   enclave->state = RUNNING;
 
 run_enclave_out:
@@ -462,6 +617,34 @@ run_enclave_out:
   return retval;
 }
 
+/*
+ * Run a thread on current hart in exclusive mode: the hart stays in the
+ * enclave until the thread exits. The M-mode timer is masked so the host
+ * deadline stays pending and fires once the host gets the hart back,
+ * and the host dispatches work through the doorbell ring (see doorbell.h).
+ */
+uintptr_t run_enclave_exclusive(uintptr_t* regs, unsigned int eid, unsigned int tid)
+{
+  struct enclave_t* enclave;
+  uintptr_t retval = 0;
+
+  enclave = get_enclave(eid);
+  if(!enclave || enclave->untrusted_size < OCALL_RING_SIZE + DOORBELL_RING_SIZE)
+  {
+    printm("M mode: run_enclave_exclusive: enclave%d has no room for the doorbell ring\r\n", eid);
+    return -1UL;
+  }
+
+  retval = run_enclave(regs, eid, tid);
+  if(retval != 0)
+    return retval;
+
+  clear_csr(mie, MIP_MTIP);
+  cpus[read_csr(mhartid)].exclusive = 1;
+
+  return retval;
+}
+
 uintptr_t stop_enclave(uintptr_t* regs, unsigned int eid)
 {
   uintptr_t retval = 0;
@@ -519,7 +702,7 @@ uintptr_t resume_from_stop(uintptr_t* regs, unsigned int eid)
     goto resume_from_stop_out;
   }
 
-  enclave->state = RUNNABLE;
+  enclave->state = RUNNING;
 
 resume_from_stop_out:
   spinlock_unlock(&enclave_metadata_lock);
@@ -528,6 +711,8 @@ resume_from_stop_out:
 
 uintptr_t resume_enclave(uintptr_t* regs, unsigned int eid)
 {
+  //thread to be resumed is passed by host in regs[13]
+  int tid = regs[13];
   uintptr_t retval = 0;
   struct enclave_t* enclave = get_enclave(eid);
   if(!enclave)
@@ -556,21 +741,39 @@ uintptr_t resume_enclave(uintptr_t* regs, unsigned int eid)
     //TODO
   }
 
-  if(enclave->state != RUNNABLE)
+  if(tid < 0 || tid >= ENCLAVE_MAX_THREADS)
+  {
+    printm("M mode: resume_enclave: wrong thread id%d\r\n", tid);
+    retval = -1UL;
+    goto resume_enclave_out;
+  }
+
+  //a queued thread may have been switched in by the security monitor
+  enclave = get_active_callee(enclave, &tid);
+  if(!enclave || enclave->threads[tid].state != RUNNABLE)
+  {
+    printm("M mode: resume_enclave: thread%d of enclave%d is not runnable\r\n", tid, eid);
+    retval = -1UL;
+    goto resume_enclave_out;
+  }
+
+  if(enclave->threads[tid].hart != read_csr(mhartid))
   {
-    printm("M mode: resume_enclave: enclave%d is not runnable\r\n", eid);
+    printm("M mode: resume_enclave: thread%d is owned by hart%d, it has to be migrated first\r\n",
+        tid, enclave->threads[tid].hart);
     retval = -1UL;
     goto resume_enclave_out;
   }
+  enclave->threads[tid].queued = 0;
 
-  if(swap_from_host_to_enclave(regs, enclave) < 0)
+  if(swap_from_host_to_enclave(regs, enclave, tid) < 0)
   {
     printm("M mode: resume_enclave: enclave can not be run\r\n");
     retval = -1UL;
     goto resume_enclave_out;
   }
 
-  enclave->state = RUNNING;
+  enclave->threads[tid].state = RUNNING;
 
   //regs[10] will be set to retval when mcall_trap return, so we have to
   //set retval to be regs[10] here to succuessfully restore context
@@ -582,13 +785,27 @@ resume_enclave_out:
   return retval;
 }
 
+//remember to acquire enclave_metadata_lock before calling this function
+static int __return_relay_page(struct enclave_t* enclave)
+{
+  if(relay_page_to_host(enclave->relay_paddr, enclave->eid) < 0)
+    return -1;
+
+  enclave_unmap_range(enclave, enclave->relay_va, enclave->relay_size);
+  enclave->relay_va = 0;
+  enclave->relay_paddr = 0;
+  enclave->relay_size = 0;
+
+  return 0;
+}
+
 uintptr_t exit_enclave(uintptr_t* regs, unsigned long retval)
 {
   printm("M mode: exit_enclave: retval of enclave is %lx\r\n", retval);
 
   struct enclave_t *enclave;
   unsigned long paddr, size;
-  int i, eid;
+  int i, eid, tid;
 
   if(check_in_enclave_world() < 0)
   {
@@ -597,6 +814,7 @@ uintptr_t exit_enclave(uintptr_t* regs, unsigned long retval)
   }
 
   eid = get_enclave_id();
+  tid = get_thread_id();
   enclave = get_enclave(eid);
   if(!enclave)
   {
@@ -613,12 +831,44 @@ uintptr_t exit_enclave(uintptr_t* regs, unsigned long retval)
     return -1UL;
   }
 
-  swap_from_enclave_to_host(regs, enclave);
+  if(enclave->caller_eid >= 0)
+  {
+    printm("M mode: exit_enclave: enclave%d is serving a call from enclave%d\r\n", eid, enclave->caller_eid);
+    spinlock_unlock(&enclave_metadata_lock);
+    return -1UL;
+  }
+
+  swap_from_enclave_to_host(regs, enclave, tid);
+  enclave->threads[tid].state = INVALID;
+  report_switched_thread(regs, enclave, tid);
+
+  //the enclave is freed when its last thread exits
+  if(count_enclave_threads(enclave, INVALID) < ENCLAVE_MAX_THREADS)
+  {
+    spinlock_unlock(&enclave_metadata_lock);
+    return 0;
+  }
+
+  //no more threads can be started from now on
+  enclave->state = DESTROYED;
+
+  //release shared memory objects, their memory is not owned by the enclave
+  if(enclave->shm_id >= 0)
+    shm_detach(enclave->shm_id, eid);
+  shm_release_enclave(eid);
+
+  //give the relay page back to the host, its data is kept
+  if(enclave->relay_size)
+    __return_relay_page(enclave);
 
   //free enclave's memory
-  //TODO: support multiple memory region
   memset((void*)(enclave->paddr), 0, enclave->size);
   mm_free((void*)(enclave->paddr), enclave->size);
+  if(enclave->extent_size)
+  {
+    memset((void*)(enclave->extent_paddr), 0, enclave->extent_size);
+    mm_free((void*)(enclave->extent_paddr), enclave->extent_size);
+  }
 
   spinlock_unlock(&enclave_metadata_lock);
   
@@ -628,34 +878,1284 @@ uintptr_t exit_enclave(uintptr_t* regs, unsigned long retval)
   return 0;
 }
 
-uintptr_t do_timer_irq(uintptr_t *regs, uintptr_t mcause, uintptr_t mepc)
+/*
+ * Move the saved host context (everything restored by
+ * swap_from_enclave_to_host) from one enclave to another.
+ */
+static void transfer_host_context(struct thread_state_t* from, struct thread_state_t* to)
+{
+  to->prev_stvec = from->prev_stvec;
+  to->prev_mie = from->prev_mie;
+  to->prev_mideleg = from->prev_mideleg;
+  to->prev_medeleg = from->prev_medeleg;
+  to->prev_mepc = from->prev_mepc;
+  to->prev_cache_binding = from->prev_cache_binding;
+}
+
+/*
+ * Synchronous enclave-to-enclave call.
+ * The calling thread's context is parked in its own thread slot and the
+ * host context it was holding is handed to thread0 of the callee, so that
+ * timer irqs and ocalls taken by the callee still return to the right host.
+ * The callee starts at its entry point with arg0/arg1 in a4/a5 and the
+ * caller's eid in a6, and comes back with SBI_ENCLAVE_RETURN.
+ */
+uintptr_t call_enclave(uintptr_t* regs, unsigned int callee_eid, uintptr_t arg0, uintptr_t arg1)
 {
+  struct enclave_t *caller, *callee;
+  struct thread_state_t *caller_thread, *callee_thread;
   uintptr_t retval = 0;
-  unsigned int eid = get_enclave_id();
-  struct enclave_t *enclave = get_enclave(eid);
-  if(!enclave)
+  int eid, tid;
+
+  if(check_in_enclave_world() < 0)
   {
-    printm("M mode: something is wrong with enclave%d\r\n", eid);
+    printm("M mode: call_enclave: cpu is not in enclave world now\r\n");
+    return -1UL;
+  }
+
+  eid = get_enclave_id();
+  tid = get_thread_id();
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  caller = __get_enclave(eid);
+  callee = __get_enclave(callee_eid);
+  if(!caller || !callee || caller == callee)
+  {
+    printm("M mode: call_enclave: wrong enclave id%d\r\n", callee_eid);
+    retval = -1UL;
+    goto call_enclave_out;
+  }
+
+  if(check_enclave_authentication(caller) < 0 || caller->threads[tid].state != RUNNING)
+  {
+    printm("M mode: call_enclave: current enclave's eid is not %d\r\n", eid);
+    retval = -1UL;
+    goto call_enclave_out;
+  }
+
+  if(callee->state != FRESH)
+  {
+    printm("M mode: call_enclave: enclave%d is busy or not initialized\r\n", callee_eid);
+    retval = -1UL;
+    goto call_enclave_out;
+  }
+
+  if(callee->host_ptbr != caller->host_ptbr)
+  {
+    printm("M mode: call_enclave: enclave%d doesn't belong to current host process\r\n", callee_eid);
+    retval = -1UL;
+    goto call_enclave_out;
+  }
+
+  //switch memory access from caller to callee
+  retrieve_enclave_access(caller);
+  if(grant_enclave_access(callee) < 0)
+  {
+    printm("M mode: call_enclave: enclave%d can not be run\r\n", callee_eid);
+    grant_enclave_access(caller);
+    retval = -1UL;
+    goto call_enclave_out;
+  }
+
+  caller_thread = &(caller->threads[tid].context);
+  callee_thread = &(callee->threads[0].context);
+
+  //park caller's registers, the host registers go to the callee
+  swap_prev_state(caller_thread, regs);
+  swap_prev_state(callee_thread, regs);
+
+  transfer_host_context(caller_thread, callee_thread);
+  caller_thread->prev_mepc = read_csr(mepc);
+
+  //the callee's own deadline replaces the caller's one
+  caller->threads[tid].timer_deadline = timer_get(TIMER_ENCLAVE);
+  timer_set(TIMER_ENCLAVE, callee->threads[0].timer_deadline);
+  timer_program();
+
+  switch_to_enclave_ptbr(callee_thread, callee_thread->encl_ptbr);
+  write_csr(mepc, (uintptr_t)(callee->entry_point));
+
+  //set default stack of thread0 and pass parameters
+  regs[2] = ENCLAVE_DEFAULT_STACK;
+  regs[11] = (uintptr_t)callee->entry_point;
+  regs[12] = (uintptr_t)callee->untrusted_ptr;
+  regs[13] = (uintptr_t)callee->untrusted_size;
+  regs[14] = arg0;
+  regs[15] = arg1;
+  regs[16] = (uintptr_t)caller->eid;
+  regs[17] = 0;
+
+  caller->threads[tid].callee_eid = callee->eid;
+  callee->caller_eid = caller->eid;
+  callee->caller_tid = tid;
+  callee->threads[0].state = RUNNING;
+  callee->threads[0].hart = read_csr(mhartid);
+  callee->state = RUNNING;
+
+  enter_enclave_world(callee->eid, 0);
+
+  __asm__ __volatile__ ("sfence.vma" : : : "memory");
+
+call_enclave_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+uintptr_t enclave_return(uintptr_t* regs, uintptr_t retval)
+{
+  struct enclave_t *caller, *callee;
+  struct thread_state_t *caller_thread, *callee_thread;
+  int eid, caller_tid;
+
+  if(check_in_enclave_world() < 0)
+  {
+    printm("M mode: enclave_return: cpu is not in enclave world now\r\n");
     return -1UL;
   }
 
+  eid = get_enclave_id();
+
   spinlock_lock(&enclave_metadata_lock);
 
-  //TODO: check whether this enclave is destroyed
-  if(enclave->state == DESTROYED)
+  callee = __get_enclave(eid);
+  if(!callee || check_enclave_authentication(callee) < 0 || get_thread_id() != 0)
   {
-    //TODO
+    printm("M mode: enclave_return: current enclave's eid is not %d\r\n", eid);
+    retval = -1UL;
+    goto enclave_return_out;
   }
 
-  if(enclave->state != RUNNING && enclave->state != STOPPED)
+  caller = callee->caller_eid >= 0 ? __get_enclave(callee->caller_eid) : NULL;
+  if(!caller)
   {
-    printm("M mode: smething is wrong with enclave%d\r\n", eid);
-    retval = -1;
-    goto timer_irq_out;
+    printm("M mode: enclave_return: enclave%d is not called by another enclave\r\n", eid);
+    retval = -1UL;
+    goto enclave_return_out;
+  }
+
+  //switch memory access from callee back to caller
+  retrieve_enclave_access(callee);
+  if(grant_enclave_access(caller) < 0)
+  {
+    printm("M mode: enclave_return: enclave%d can not be run\r\n", caller->eid);
+    grant_enclave_access(callee);
+    retval = -1UL;
+    goto enclave_return_out;
+  }
+
+  caller_tid = callee->caller_tid;
+  caller_thread = &(caller->threads[caller_tid].context);
+  callee_thread = &(callee->threads[0].context);
+
+  //hand the host registers back to the caller and restore its own ones
+  swap_prev_state(callee_thread, regs);
+  swap_prev_state(caller_thread, regs);
+
+  write_csr(mepc, caller_thread->prev_mepc);
+  transfer_host_context(callee_thread, caller_thread);
+
+  callee->threads[0].timer_deadline = TIMER_NONE;
+  timer_set(TIMER_ENCLAVE, caller->threads[caller_tid].timer_deadline);
+  timer_program();
+
+  switch_to_enclave_ptbr(caller_thread, caller_thread->encl_ptbr);
+
+  caller->threads[caller_tid].callee_eid = -1;
+  callee->caller_eid = -1;
+  callee->caller_tid = -1;
+  callee->threads[0].state = INVALID;
+  callee->state = FRESH;
+
+  enter_enclave_world(caller->eid, caller_tid);
+
+  __asm__ __volatile__ ("sfence.vma" : : : "memory");
+
+enclave_return_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  //retval is written to caller's a0 as the result of its call
+  return retval;
+}
+
+/*
+ * Attach a shared memory object granted to current enclave at va.
+ * The pages are mapped by the security monitor and the access is
+ * enforced through SHM_SPMP_IDX.
+ */
+uintptr_t attach_shm(uintptr_t* regs, int shm_id, uintptr_t va)
+{
+  struct enclave_t *enclave;
+  struct shm_t shm;
+  unsigned long perm = 0;
+  uintptr_t retval = 0;
+  int eid;
+
+  if(check_in_enclave_world() < 0)
+  {
+    printm("M mode: attach_shm: cpu is not in enclave world now\r\n");
+    return -1UL;
+  }
+
+  eid = get_enclave_id();
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || check_enclave_authentication(enclave) < 0)
+  {
+    printm("M mode: attach_shm: current enclave's eid is not %d\r\n", eid);
+    retval = -1UL;
+    goto attach_shm_out;
+  }
+
+  if(enclave->shm_id >= 0)
+  {
+    printm("M mode: attach_shm: enclave%d has already attached shm%d\r\n", eid, enclave->shm_id);
+    retval = -1UL;
+    goto attach_shm_out;
+  }
+
+  if(check_single_running_thread(enclave) < 0)
+  {
+    printm("M mode: attach_shm: other threads of enclave%d are running\r\n", eid);
+    retval = -1UL;
+    goto attach_shm_out;
+  }
+
+  if(shm_attach(shm_id, eid, va, &shm, &perm) < 0)
+  {
+    retval = -1UL;
+    goto attach_shm_out;
+  }
+
+  if(enclave_map_range(enclave, va, shm.paddr, shm.size,
+        ENCLAVE_PTE_TYPE(PTE_R | ((perm & SHM_PERM_W) ? PTE_W : 0))) < 0)
+  {
+    shm_detach(shm_id, eid);
+    retval = -1UL;
+    goto attach_shm_out;
+  }
+
+  retrieve_enclave_access(enclave);
+  enclave->shm_id = shm_id;
+  enclave->shm_va = va;
+  enclave->shm_paddr = shm.paddr;
+  enclave->shm_size = shm.size;
+  enclave->shm_perm = perm;
+  if(grant_enclave_access(enclave) < 0)
+  {
+    printm("M mode: attach_shm: shm%d can not be accessed by enclave%d\r\n", shm_id, eid);
+    enclave_unmap_range(enclave, va, shm.size);
+    enclave->shm_id = -1;
+    enclave->shm_size = 0;
+    grant_enclave_access(enclave);
+    shm_detach(shm_id, eid);
+    retval = -1UL;
+  }
+
+  __asm__ __volatile__ ("sfence.vma" : : : "memory");
+
+attach_shm_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+uintptr_t detach_shm(uintptr_t* regs)
+{
+  struct enclave_t *enclave;
+  uintptr_t retval = 0;
+  int eid;
+
+  if(check_in_enclave_world() < 0)
+  {
+    printm("M mode: detach_shm: cpu is not in enclave world now\r\n");
+    return -1UL;
   }
-  swap_from_enclave_to_host(regs, enclave);
-  enclave->state = RUNNABLE;
+
+  eid = get_enclave_id();
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || check_enclave_authentication(enclave) < 0 || enclave->shm_id < 0)
+  {
+    printm("M mode: detach_shm: enclave%d has no shm attached\r\n", eid);
+    retval = -1UL;
+    goto detach_shm_out;
+  }
+
+  if(check_single_running_thread(enclave) < 0)
+  {
+    printm("M mode: detach_shm: other threads of enclave%d are running\r\n", eid);
+    retval = -1UL;
+    goto detach_shm_out;
+  }
+
+  retrieve_enclave_access(enclave);
+  enclave_unmap_range(enclave, enclave->shm_va, enclave->shm_size);
+  shm_detach(enclave->shm_id, eid);
+  enclave->shm_id = -1;
+  enclave->shm_va = 0;
+  enclave->shm_paddr = 0;
+  enclave->shm_size = 0;
+  enclave->shm_perm = 0;
+  grant_enclave_access(enclave);
+
+  __asm__ __volatile__ ("sfence.vma" : : : "memory");
+
+detach_shm_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+/*
+ * Hand the host-owned relay page over to a stopped enclave at va.
+ * The host loses its PMP access before the pages are mapped, so only
+ * one side can touch the data at a time and nothing is copied.
+ */
+uintptr_t transfer_relay_page(unsigned int eid, uintptr_t paddr, uintptr_t va)
+{
+  struct enclave_t *enclave;
+  unsigned long size = 0;
+  uintptr_t retval = 0;
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || enclave->state == INVALID || enclave->host_ptbr != read_csr(satp))
+  {
+    printm("M mode: transfer_relay_page: enclave%d doesn't belong to current host process\r\n", eid);
+    retval = -1UL;
+    goto transfer_relay_page_out;
+  }
+
+  //enclave's sPMP is only reloaded when it is scheduled again
+  if(count_enclave_threads(enclave, RUNNING) > 0 || enclave->relay_size)
+  {
+    printm("M mode: transfer_relay_page: enclave%d is running or already owns a relay page\r\n", eid);
+    retval = -1UL;
+    goto transfer_relay_page_out;
+  }
+
+  if(relay_page_to_enclave(paddr, read_csr(satp), eid, &size) < 0)
+  {
+    retval = -1UL;
+    goto transfer_relay_page_out;
+  }
+
+  if(enclave_map_range(enclave, va, paddr, size, ENCLAVE_PTE_TYPE(PTE_R | PTE_W)) < 0)
+  {
+    relay_page_to_host(paddr, eid);
+    retval = -1UL;
+    goto transfer_relay_page_out;
+  }
+
+  enclave->relay_va = va;
+  enclave->relay_paddr = paddr;
+  enclave->relay_size = size;
+
+transfer_relay_page_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+/*
+ * Give the relay page owned by current enclave back to the host.
+ */
+uintptr_t return_relay_page(uintptr_t* regs)
+{
+  struct enclave_t *enclave;
+  uintptr_t retval = 0;
+  int eid;
+
+  if(check_in_enclave_world() < 0)
+  {
+    printm("M mode: return_relay_page: cpu is not in enclave world now\r\n");
+    return -1UL;
+  }
+
+  eid = get_enclave_id();
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || check_enclave_authentication(enclave) < 0 || !enclave->relay_size)
+  {
+    printm("M mode: return_relay_page: enclave%d owns no relay page\r\n", eid);
+    retval = -1UL;
+    goto return_relay_page_out;
+  }
+
+  if(check_single_running_thread(enclave) < 0)
+  {
+    printm("M mode: return_relay_page: other threads of enclave%d are running\r\n", eid);
+    retval = -1UL;
+    goto return_relay_page_out;
+  }
+
+  //close enclave's own access before the host gets it back
+  retrieve_enclave_access(enclave);
+  if(__return_relay_page(enclave) < 0)
+    retval = -1UL;
+  grant_enclave_access(enclave);
+
+  __asm__ __volatile__ ("sfence.vma" : : : "memory");
+
+return_relay_page_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+/*
+ * Synchronous ocall. The request is written to the host through the
+ * ocall_func_id/ocall_arg* pointers given at creation time and the cpu
+ * is switched back to the host, which resumes the enclave with
+ * RESUME_FROM_OCALL once the request has been served.
+ *
+ * Enclaves using the exitless ocall ring (see ocall.h) only come here
+ * with OCALL_RING_KICK when the host worker is not polling the ring.
+ */
+uintptr_t enclave_ocall(uintptr_t* regs, uintptr_t ocall_func_id, uintptr_t arg0, uintptr_t arg1)
+{
+  struct enclave_t *enclave;
+  unsigned long syscall_num = regs[13];
+  uintptr_t retval = 0;
+  int eid, tid;
+
+  if(check_in_enclave_world() < 0)
+  {
+    printm("M mode: enclave_ocall: cpu is not in enclave world now\r\n");
+    return -1UL;
+  }
+
+  eid = get_enclave_id();
+  tid = get_thread_id();
+  enclave = get_enclave(eid);
+  if(!enclave)
+  {
+    printm("M mode: enclave_ocall: didn't find eid%d 's corresponding enclave\r\n", eid);
+    return -1UL;
+  }
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  if(check_enclave_authentication(enclave) < 0)
+  {
+    printm("M mode: enclave_ocall: current enclave's eid is not %d\r\n", eid);
+    retval = -1UL;
+    goto enclave_ocall_out;
+  }
+
+  if(enclave->threads[tid].state != RUNNING)
+  {
+    printm("M mode: enclave_ocall: thread%d of enclave%d is not running\r\n", tid, eid);
+    retval = -1UL;
+    goto enclave_ocall_out;
+  }
+
+  //there is no host to return to, the ocall ring has to be used
+  if(check_exclusive_hart())
+  {
+    printm("M mode: enclave_ocall: enclave%d runs on an exclusive hart\r\n", eid);
+    retval = -1UL;
+    goto enclave_ocall_out;
+  }
+
+  //the ocall pointers come from the host, so make sure they still point to host memory
+  if(check_host_memory((uintptr_t)enclave->ocall_func_id, sizeof(unsigned long)) < 0
+      || check_host_memory((uintptr_t)enclave->ocall_arg0, sizeof(unsigned long)) < 0
+      || check_host_memory((uintptr_t)enclave->ocall_arg1, sizeof(unsigned long)) < 0
+      || check_host_memory((uintptr_t)enclave->ocall_syscall_num, sizeof(unsigned long)) < 0)
+  {
+    printm("M mode: enclave_ocall: ocall arguments of enclave%d are not in host memory\r\n", eid);
+    retval = -1UL;
+    goto enclave_ocall_out;
+  }
+
+  copy_to_host(enclave->ocall_func_id, &ocall_func_id, sizeof(unsigned long));
+  copy_to_host(enclave->ocall_arg0, &arg0, sizeof(unsigned long));
+  copy_to_host(enclave->ocall_arg1, &arg1, sizeof(unsigned long));
+  copy_to_host(enclave->ocall_syscall_num, &syscall_num, sizeof(unsigned long));
+
+  swap_from_enclave_to_host(regs, enclave, tid);
+  enclave->threads[tid].state = OCALLING;
+  report_switched_thread(regs, enclave, tid);
+  retval = ENCLAVE_OCALL;
+
+enclave_ocall_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+uintptr_t resume_from_ocall(uintptr_t* regs, unsigned int eid)
+{
+  //return value of the ocall is passed by host in regs[12]
+  //and the thread to be resumed in regs[13]
+  uintptr_t ocall_retval = regs[12];
+  int tid = regs[13];
+  uintptr_t retval = 0;
+  struct enclave_t* enclave = get_enclave(eid);
+  if(!enclave)
+  {
+    printm("M mode: resume_from_ocall: wrong enclave id%d\r\n", eid);
+    return -1UL;
+  }
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  if(enclave->host_ptbr != read_csr(satp))
+  {
+    printm("M mode: resume_from_ocall: enclave doesn't belong to current host process\r\n");
+    retval = -1UL;
+    goto resume_from_ocall_out;
+  }
+
+  if(tid < 0 || tid >= ENCLAVE_MAX_THREADS)
+  {
+    printm("M mode: resume_from_ocall: wrong thread id%d\r\n", tid);
+    retval = -1UL;
+    goto resume_from_ocall_out;
+  }
+
+  enclave = get_active_callee(enclave, &tid);
+  if(!enclave || enclave->threads[tid].state != OCALLING)
+  {
+    printm("M mode: resume_from_ocall: thread%d of enclave%d is not waiting for an ocall\r\n", tid, eid);
+    retval = -1UL;
+    goto resume_from_ocall_out;
+  }
+
+  if(enclave->threads[tid].hart != read_csr(mhartid))
+  {
+    printm("M mode: resume_from_ocall: thread%d is owned by hart%d, it has to be migrated first\r\n",
+        tid, enclave->threads[tid].hart);
+    retval = -1UL;
+    goto resume_from_ocall_out;
+  }
+
+  if(swap_from_host_to_enclave(regs, enclave, tid) < 0)
+  {
+    printm("M mode: resume_from_ocall: enclave can not be run\r\n");
+    retval = -1UL;
+    goto resume_from_ocall_out;
+  }
+
+  enclave->threads[tid].state = RUNNING;
+
+  //retval will be written to enclave's a0 as the result of its ocall
+  retval = ocall_retval;
+
+resume_from_ocall_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+/*
+ * Only threads of the same host process can be switched in, because they
+ * inherit the host context of the thread being switched out.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+static int filter_queued_thread(int hart, int eid, int tid, void* arg)
+{
+  struct enclave_t* enclave = __get_enclave(eid);
+  unsigned long host_ptbr = *(unsigned long*)arg;
+
+  //entries left behind by a migrated thread are dropped
+  if(!enclave || enclave->threads[tid].state != RUNNABLE || !enclave->threads[tid].queued
+      || enclave->threads[tid].hart != hart)
+    return RUN_QUEUE_DROP;
+
+  if(enclave->host_ptbr != host_ptbr || enclave->state == STOPPED)
+    return RUN_QUEUE_SKIP;
+
+  return RUN_QUEUE_TAKE;
+}
+
+/*
+ * The time slice of current thread is used up while the host deadline is
+ * not due: switch to a queued thread of this hart, or steal one from
+ * another hart, without going through the host.
+ * Return -1 if nothing else can be run and current thread goes on.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+static int schedule_next_thread(uintptr_t* regs, struct enclave_t* enclave, int tid)
+{
+  struct enclave_t* next;
+  unsigned long host_ptbr = enclave->host_ptbr;
+  int hart = read_csr(mhartid);
+  int next_eid, next_tid;
+
+  if(run_queue_full(hart))
+    return -1;
+
+  if(run_queue_pop(hart, filter_queued_thread, &host_ptbr, &next_eid, &next_tid) < 0
+      && run_queue_steal(hart, filter_queued_thread, &host_ptbr, &next_eid, &next_tid) < 0)
+    return -1;
+
+  next = __get_enclave(next_eid);
+  next->threads[next_tid].queued = 0;
+
+  swap_from_enclave_to_host(regs, enclave, tid);
+  enclave->threads[tid].state = RUNNABLE;
+
+  if(swap_from_host_to_enclave(regs, next, next_tid) < 0)
+  {
+    printm("M mode: schedule_next_thread: enclave%d can not be run\r\n", next_eid);
+    next->threads[next_tid].queued = 1;
+    run_queue_push(hart, next_eid, next_tid);
+    regs[10] = ENCLAVE_TIMER_IRQ;
+    report_switched_thread(regs, enclave, tid);
+    return 0;
+  }
+
+  next->threads[next_tid].state = RUNNING;
+  enclave->threads[tid].queued = 1;
+  run_queue_push(hart, enclave->eid, tid);
+
+  return 0;
+}
+
+/*
+ * Hand a thread which is switched out over to dest_hart, where the host
+ * has to resume it from now on. The thread left the old hart through
+ * swap_from_enclave_to_host, which already dropped its PMP/sPMP setting,
+ * flushed the TLB and gave timecmp back to the host, so only the
+ * ownership and the run queue entry move. mtime is shared by all harts,
+ * so the absolute deadlines of the thread stay valid on dest_hart.
+ */
+uintptr_t migrate_enclave(unsigned int eid, int tid, int dest_hart)
+{
+  struct enclave_t* enclave;
+  struct enclave_thread_t* thread;
+  uintptr_t retval = 0;
+
+  if(tid < 0 || tid >= ENCLAVE_MAX_THREADS || dest_hart < 0 || dest_hart >= MAX_HARTS
+      || !hartmask_test(&hart_mask, dest_hart))
+  {
+    printm("M mode: migrate_enclave: wrong thread id%d or hart%d\r\n", tid, dest_hart);
+    return -1UL;
+  }
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || enclave->state == INVALID || enclave->host_ptbr != read_csr(satp))
+  {
+    printm("M mode: migrate_enclave: enclave%d doesn't belong to current host process\r\n", eid);
+    retval = -1UL;
+    goto migrate_enclave_out;
+  }
+
+  //the host context is held by the innermost callee
+  enclave = get_active_callee(enclave, &tid);
+  thread = &(enclave->threads[tid]);
+  if(thread->state != RUNNABLE && thread->state != OCALLING)
+  {
+    printm("M mode: migrate_enclave: thread%d of enclave%d is not switched out\r\n", tid, eid);
+    retval = -1UL;
+    goto migrate_enclave_out;
+  }
+
+  if(thread->hart == dest_hart)
+    goto migrate_enclave_out;
+
+  thread->hart = dest_hart;
+  if(thread->queued && run_queue_push(dest_hart, enclave->eid, tid) < 0)
+    thread->queued = 0;
+
+migrate_enclave_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+uintptr_t set_enclave_time_slice(unsigned int eid, unsigned long time_slice)
+{
+  struct enclave_t* enclave;
+  uintptr_t retval = 0;
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || enclave->state == INVALID || enclave->host_ptbr != read_csr(satp))
+  {
+    printm("M mode: set_enclave_time_slice: enclave%d doesn't belong to current host process\r\n", eid);
+    retval = -1UL;
+    goto set_enclave_time_slice_out;
+  }
+
+  enclave->time_slice = time_slice;
+
+set_enclave_time_slice_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+/*
+ * Move the memory of an enclave to new_paddr, none of its threads may be
+ * on a hart. Its page table and everything pointing into its memory are
+ * rebased, and the old block is zeroed and given back to the buddy system.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+static void relocate_enclave(struct enclave_t* enclave, uintptr_t new_paddr)
+{
+  uintptr_t old_paddr = enclave->paddr;
+  unsigned long* link;
+  int i;
+
+  memcpy((void*)new_paddr, (void*)old_paddr, enclave->size);
+
+  enclave->paddr = new_paddr;
+  enclave->free_mem = enclave->free_mem - old_paddr + new_paddr;
+  enclave->root_page_table = (unsigned long*)((uintptr_t)enclave->root_page_table - old_paddr + new_paddr);
+  enclave_rebase_page_table(enclave, old_paddr);
+  for(link = &enclave->free_pages; *link; link = (unsigned long*)*link)
+  {
+    if(*link >= old_paddr && *link < old_paddr + enclave->size)
+      *link = *link - old_paddr + new_paddr;
+  }
+  for(i = 0; i < ENCLAVE_MAX_THREADS; ++i)
+  {
+    enclave->threads[i].context.encl_ptbr = ((uintptr_t)enclave->root_page_table >> RISCV_PGSHIFT)
+      | SATP_MODE_CHOICE;
+  }
+
+  memset((void*)old_paddr, 0, enclave->size);
+  mm_free((void*)old_paddr, enclave->size);
+}
+
+/*
+ * Compact the enclave memory pool by relocating enclaves that are not on
+ * any hart (FRESH, STOPPED or with RUNNABLE/OCALLING threads only) to holes
+ * of the buddy system, so that their old blocks merge into larger free
+ * ones. It is meant to be called by the host on idle harts and stops once
+ * budget mtime ticks are spent, checked between two relocations.
+ * Return the number of enclaves relocated.
+ */
+uintptr_t compact_enclave_memory(unsigned long budget)
+{
+  struct link_mem_t *cur;
+  struct enclave_t *enclave;
+  uint64_t deadline = *mtime + budget;
+  uintptr_t new_paddr = 0;
+  uintptr_t moved = 0;
+  int i;
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  for(cur = enclave_metadata_head; cur != NULL; cur = cur->next_link_mem)
+  {
+    for(i = 0; i < (cur->slab_num); i++)
+    {
+      if(*mtime >= deadline)
+        goto compact_enclave_memory_out;
+
+      enclave = (struct enclave_t*)(cur->addr) + i;
+      if(enclave->state < FRESH || count_enclave_threads(enclave, RUNNING) > 0)
+        continue;
+
+      if(mm_alloc_compaction_target(enclave->paddr, enclave->size, &new_paddr) < 0)
+        continue;
+
+      relocate_enclave(enclave, new_paddr);
+      moved++;
+    }
+  }
+
+compact_enclave_memory_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return moved;
+}
+
+//take an extent from the buddy system, as large as enclave's memory if possible
+static int alloc_enclave_extent(struct enclave_t* enclave)
+{
+  unsigned long size = 0;
+  unsigned long resp_size = 0;
+  void* paddr = NULL;
+
+  for(size = enclave->size; size >= RISCV_PGSIZE; size >>= 1)
+  {
+    paddr = mm_alloc(size, &resp_size);
+    if(paddr)
+      break;
+  }
+  if(!paddr)
+    return -1;
+
+  enclave->extent_paddr = (unsigned long)paddr;
+  enclave->extent_size = resp_size;
+  enclave->extent_free = (unsigned long)paddr;
+
+  //reload the memory access of current hart with the extent
+  if(grant_enclave_access(enclave) < 0)
+  {
+    enclave->extent_size = 0;
+    grant_enclave_access(enclave);
+    mm_free(paddr, resp_size);
+    return -1;
+  }
+
+  return 0;
+}
+
+//page of enclave's own memory for a fault, grown with an extent if needed
+static void* alloc_fault_page(struct enclave_t* enclave)
+{
+  void* page = enclave_alloc_page(enclave);
+
+  //threads on other harts would not see the extent in their sPMP
+  if(!page && !enclave->extent_size && check_single_running_thread(enclave) == 0
+      && alloc_enclave_extent(enclave) == 0)
+    page = enclave_alloc_page(enclave);
+  if(!page)
+    printm("M mode: enclave_page_fault: enclave%d is out of memory\r\n", enclave->eid);
+
+  return page;
+}
+
+//map the whole 2 MiB around va with one leaf if nothing is mapped there yet
+static int map_fault_megapage(struct enclave_t* enclave, uintptr_t va)
+{
+  uintptr_t mega_va = va & ~(ENCLAVE_MEGAPAGE_SIZE - 1);
+  int level = 1;
+  pte_t* pte;
+  void* page;
+
+  if(mega_va < ENCLAVE_DEMAND_PAGING_BASE || mega_va + ENCLAVE_MEGAPAGE_SIZE > ENCLAVE_DEFAULT_STACK)
+    return -1;
+
+  //the page table pages above the leaf are taken before the megapage
+  pte = enclave_walk_level(enclave, mega_va, &level, 1);
+  if(!pte || level != 1 || *pte)
+    return -1;
+
+  page = enclave_alloc_megapage(enclave);
+  if(!page)
+    return -1;
+  *pte = pte_create((uintptr_t)page >> RISCV_PGSHIFT, ENCLAVE_PTE_TYPE(PTE_R | PTE_W));
+
+  return 0;
+}
+
+//bring a swapped page back from the host, checking that it is untouched
+static int swap_in_page(struct enclave_t* enclave, uintptr_t va, pte_t* pte)
+{
+  unsigned long slot = SWAP_PTE_SLOT(*pte);
+  unsigned long version = SWAP_PTE_VERSION(*pte);
+  struct swap_slot_t* swap_slot = &(enclave->swap_area[slot]);
+  void* page;
+
+  if(slot >= enclave->swap_slots
+      || check_host_memory((uintptr_t)swap_slot, sizeof(struct swap_slot_t)) < 0)
+    return -1;
+
+  page = alloc_fault_page(enclave);
+  if(!page)
+    return -1;
+
+  if(swap_decrypt_page(enclave->swap_id, va, version, swap_slot, page) < 0)
+  {
+    printm("M mode: enclave_page_fault: swapped page 0x%lx of enclave%d is corrupted\r\n", va, enclave->eid);
+    enclave_free_page(enclave, page);
+    return -1;
+  }
+
+  *pte = pte_create((uintptr_t)page >> RISCV_PGSHIFT, (*pte & SWAP_PTE_PERM) | PTE_A | PTE_D);
+  swap_slot->state = SWAP_SLOT_FREE;
+
+  return 0;
+}
+
+/*
+ * Resolve a page fault of current enclave thread. A swapped page is
+ * decrypted back from the host, and an unmapped page in the heap and
+ * stack area is mapped with a zeroed page. Pages come from the rest of
+ * enclave's memory and then from an extent allocated from the buddy
+ * system. A 2 MiB leaf is used when nothing else is mapped in the 2 MiB
+ * around the fault and there is an aligned 2 MiB of free memory left.
+ * Return 0 if the faulting instruction can be retried.
+ */
+int enclave_page_fault(uintptr_t* regs, uintptr_t mcause, uintptr_t badaddr)
+{
+  struct enclave_t *enclave;
+  uintptr_t va = badaddr & ~(RISCV_PGSIZE - 1);
+  uintptr_t perm = 0;
+  pte_t* pte = NULL;
+  void* page = NULL;
+  int retval = -1;
+
+  if(check_in_enclave_world() < 0)
+    return -1;
+
+  switch(mcause)
+  {
+    case CAUSE_FETCH_PAGE_FAULT:
+      perm = PTE_X;
+      break;
+    case CAUSE_LOAD_PAGE_FAULT:
+      perm = PTE_R;
+      break;
+    case CAUSE_STORE_PAGE_FAULT:
+      perm = PTE_W;
+      break;
+    default:
+      return -1;
+  }
+
+  enclave = get_enclave(get_enclave_id());
+  if(!enclave)
+    return -1;
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  if(check_enclave_authentication(enclave) < 0)
+    goto enclave_page_fault_out;
+
+  pte = enclave_walk(enclave, va, 0);
+  if(pte && (*pte & PTE_V))
+  {
+    if(PTE_TABLE(*pte) || !(*pte & PTE_U) || !(*pte & perm))
+      goto enclave_page_fault_out;
+
+    //another thread of the enclave may have mapped the page meanwhile,
+    //or the accessed bit cleared by eviction is not set by hardware
+    *pte |= PTE_A | (perm == PTE_W ? PTE_D : 0);
+    retval = 0;
+    goto enclave_page_fault_out;
+  }
+
+  if(pte && (*pte & PTE_SWAPPED))
+  {
+    if((*pte & perm) && swap_in_page(enclave, va, pte) == 0)
+      retval = 0;
+    goto enclave_page_fault_out;
+  }
+
+  //demand paged memory is never executable
+  if(va < ENCLAVE_DEMAND_PAGING_BASE || va >= ENCLAVE_DEFAULT_STACK || perm == PTE_X)
+    goto enclave_page_fault_out;
+
+  if(map_fault_megapage(enclave, va) == 0)
+  {
+    retval = 0;
+    goto enclave_page_fault_out;
+  }
+
+  page = alloc_fault_page(enclave);
+  if(!page)
+    goto enclave_page_fault_out;
+
+  if(enclave_map_range(enclave, va, (uintptr_t)page, RISCV_PGSIZE, ENCLAVE_PTE_TYPE(PTE_R | PTE_W)) < 0)
+    goto enclave_page_fault_out;
+
+  retval = 0;
+
+enclave_page_fault_out:
+  spinlock_unlock(&enclave_metadata_lock);
+
+  if(retval == 0)
+    __asm__ __volatile__ ("sfence.vma" : : : "memory");
+
+  return retval;
+}
+
+struct evict_ctx_t
+{
+  unsigned long nr_pages;
+  unsigned long evicted;
+};
+
+//remember to acquire enclave_metadata_lock before calling this function
+static long find_free_swap_slot(struct enclave_t* enclave)
+{
+  unsigned long i, slot;
+
+  for(i = 0; i < enclave->swap_slots; ++i)
+  {
+    slot = (enclave->swap_next_slot + i) % enclave->swap_slots;
+    if(enclave->swap_area[slot].state != SWAP_SLOT_FREE)
+      continue;
+    //host memory may have been donated to the buddy system since
+    if(check_host_memory((uintptr_t)&(enclave->swap_area[slot]), sizeof(struct swap_slot_t)) < 0)
+      return -1;
+    enclave->swap_next_slot = slot + 1;
+    return slot;
+  }
+
+  return -1;
+}
+
+/*
+ * One sweep of the clock over enclave's pages: a page accessed since
+ * the last sweep gets its accessed bit cleared, the others are evicted.
+ */
+static int evict_cold_page(struct enclave_t* enclave, uintptr_t va, pte_t* pte, void* arg)
+{
+  struct evict_ctx_t* ctx = arg;
+  uintptr_t paddr = ((*pte & ENCLAVE_PTE_PPN_MASK) >> PTE_PPN_SHIFT) << RISCV_PGSHIFT;
+  long slot;
+
+  if(!(*pte & PTE_U) || !enclave_owns_page(enclave, paddr))
+    return 0;
+
+  if(*pte & PTE_A)
+  {
+    *pte &= ~PTE_A;
+    return 0;
+  }
+
+  if(enclave->swap_version >= SWAP_MAX_VERSION)
+    return -1;
+  slot = find_free_swap_slot(enclave);
+  if(slot < 0)
+    return -1;
+
+  enclave->swap_version += 1;
+  swap_encrypt_page(enclave->swap_id, va, enclave->swap_version, (void*)paddr,
+      &(enclave->swap_area[slot]));
+  enclave->swap_area[slot].state = SWAP_SLOT_USED;
+
+  *pte = SWAP_PTE(slot, enclave->swap_version, *pte);
+  enclave_free_page(enclave, (void*)paddr);
+
+  ctx->evicted += 1;
+  if(ctx->evicted >= ctx->nr_pages)
+    return 1;
+
+  return 0;
+}
+
+/*
+ * Evict cold pages of an enclave none of whose threads is on a hart to
+ * the swap area given by the host. The pages freed can back new pages of
+ * the enclave and swapped pages are faulted back in by enclave_page_fault.
+ */
+uintptr_t evict_enclave_pages(unsigned int eid, struct swap_arg_t* swap_arg)
+{
+  struct enclave_t* enclave;
+  struct swap_arg_t swap_arg_local;
+  struct evict_ctx_t ctx;
+  uintptr_t retval = 0;
+
+  if(copy_from_host(&swap_arg_local, swap_arg, sizeof(struct swap_arg_t)) != 0)
+    return -1UL;
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || enclave->state < FRESH || enclave->host_ptbr != read_csr(satp))
+  {
+    printm("M mode: evict_enclave_pages: enclave%d doesn't belong to current host process\r\n", eid);
+    retval = -1UL;
+    goto evict_enclave_pages_out;
+  }
+
+  //no hart may cache the ptes changed here
+  if(count_enclave_threads(enclave, RUNNING) > 0)
+  {
+    printm("M mode: evict_enclave_pages: enclave%d is running\r\n", eid);
+    retval = -1UL;
+    goto evict_enclave_pages_out;
+  }
+
+  if(!enclave->swap_slots)
+  {
+    if(!swap_arg_local.nr_slots || swap_arg_local.nr_slots > SWAP_MAX_SLOTS
+        || (swap_arg_local.swap_area & (sizeof(unsigned long) - 1)))
+    {
+      printm("M mode: evict_enclave_pages: invalid swap area\r\n");
+      retval = -1UL;
+      goto evict_enclave_pages_out;
+    }
+    enclave->swap_id = swap_alloc_id();
+    if(!enclave->swap_id)
+    {
+      printm("M mode: evict_enclave_pages: no entropy for the swap key\r\n");
+      retval = -1UL;
+      goto evict_enclave_pages_out;
+    }
+    enclave->swap_area = (struct swap_slot_t*)swap_arg_local.swap_area;
+    enclave->swap_slots = swap_arg_local.nr_slots;
+    enclave->swap_next_slot = 0;
+    enclave->swap_version = 0;
+  }
+  else if((uintptr_t)enclave->swap_area != swap_arg_local.swap_area
+      || enclave->swap_slots != swap_arg_local.nr_slots)
+  {
+    printm("M mode: evict_enclave_pages: enclave%d has another swap area\r\n", eid);
+    retval = -1UL;
+    goto evict_enclave_pages_out;
+  }
+
+  ctx.nr_pages = swap_arg_local.nr_pages;
+  ctx.evicted = 0;
+  if(ctx.nr_pages)
+    enclave_for_each_page(enclave, evict_cold_page, &ctx);
+
+  swap_arg_local.resp_evicted = ctx.evicted;
+
+evict_enclave_pages_out:
+  spinlock_unlock(&enclave_metadata_lock);
+
+  if(retval == 0)
+    copy_to_host(swap_arg, &swap_arg_local, sizeof(struct swap_arg_t));
+
+  return retval;
+}
+
+/*
+ * Give the rest of the time slice back to the host instead of spinning
+ * until the timer preempts the thread. The host gets ENCLAVE_YIELD with
+ * wake_hint in a3, the mtime value after which the thread wants to be
+ * resumed (0 if it has none), and resumes it with RESUME_FROM_TIMER_IRQ.
+ */
+uintptr_t yield_enclave(uintptr_t* regs, uintptr_t wake_hint)
+{
+  struct enclave_t *enclave;
+  uintptr_t retval = 0;
+  int eid, tid;
+
+  if(check_in_enclave_world() < 0)
+  {
+    printm("M mode: yield_enclave: cpu is not in enclave world now\r\n");
+    return -1UL;
+  }
+
+  eid = get_enclave_id();
+  tid = get_thread_id();
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || check_enclave_authentication(enclave) < 0
+      || enclave->threads[tid].state != RUNNING)
+  {
+    printm("M mode: yield_enclave: current enclave's eid is not %d\r\n", eid);
+    retval = -1UL;
+    goto yield_enclave_out;
+  }
+
+  //there is no host to yield to
+  if(check_exclusive_hart())
+  {
+    printm("M mode: yield_enclave: enclave%d runs on an exclusive hart\r\n", eid);
+    retval = -1UL;
+    goto yield_enclave_out;
+  }
+
+  //the thread sees 0 as the result of its yield once resumed
+  regs[10] = 0;
+
+  swap_from_enclave_to_host(regs, enclave, tid);
+  enclave->threads[tid].state = RUNNABLE;
+  report_switched_thread(regs, enclave, tid);
+  regs[13] = wake_hint;
+  retval = ENCLAVE_YIELD;
+
+yield_enclave_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+/*
+ * SBI_SET_TIMER issued by an enclave thread only arms its own deadline,
+ * the host deadline is left untouched. The thread has no interrupt of
+ * its own in U mode, so the number of its deadlines fired since the
+ * previous call is returned instead.
+ */
+uintptr_t enclave_set_timer(uint64_t deadline)
+{
+  struct enclave_t *enclave;
+  uintptr_t retval = 0;
+  int eid, tid;
+
+  eid = get_enclave_id();
+  tid = get_thread_id();
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  enclave = __get_enclave(eid);
+  if(!enclave || check_enclave_authentication(enclave) < 0)
+  {
+    printm("M mode: enclave_set_timer: current enclave's eid is not %d\r\n", eid);
+    retval = -1UL;
+    goto enclave_set_timer_out;
+  }
+
+  retval = enclave->threads[tid].timer_events;
+  enclave->threads[tid].timer_events = 0;
+  timer_set(TIMER_ENCLAVE, deadline);
+  timer_program();
+
+enclave_set_timer_out:
+  spinlock_unlock(&enclave_metadata_lock);
+  return retval;
+}
+
+uintptr_t do_timer_irq(uintptr_t *regs, uintptr_t mcause, uintptr_t mepc)
+{
+  unsigned long fired;
+  uintptr_t retval = 0;
+  unsigned int eid = get_enclave_id();
+  int tid = get_thread_id();
+  struct enclave_t *enclave = get_enclave(eid);
+  if(!enclave)
+  {
+    printm("M mode: something is wrong with enclave%d\r\n", eid);
+    return -1UL;
+  }
+
+  spinlock_lock(&enclave_metadata_lock);
+
+  //TODO: check whether this enclave is destroyed
+  if(enclave->state == DESTROYED)
+  {
+    //TODO
+  }
+
+  if(enclave->threads[tid].state != RUNNING)
+  {
+    printm("M mode: smething is wrong with enclave%d\r\n", eid);
+    retval = -1;
+    goto timer_irq_out;
+  }
+
+  //timer irqs are never forwarded to the host from an exclusive hart
+  if(check_exclusive_hart())
+  {
+    clear_csr(mie, MIP_MTIP);
+    goto timer_irq_out;
+  }
+
+  fired = timer_fired(*mtime);
+
+  //the thread's own deadline is counted and it goes on running
+  if(fired & (1UL << TIMER_ENCLAVE))
+    enclave->threads[tid].timer_events++;
+
+  //the end of a time slice while the host is not due yet
+  if(!(fired & (1UL << TIMER_HOST)) && (fired & (1UL << TIMER_QUANTUM))
+      && enclave->state != STOPPED)
+  {
+    if(enclave->caller_eid >= 0 || schedule_next_thread(regs, enclave, tid) < 0)
+    {
+      start_time_slice(enclave);
+      timer_program();
+    }
+    goto timer_irq_out;
+  }
+
+  //nothing concerns the host, a stopped enclave leaves at the end of its slice
+  if(!(fired & ((1UL << TIMER_HOST) | (1UL << TIMER_QUANTUM))))
+  {
+    timer_program();
+    goto timer_irq_out;
+  }
+
+  swap_from_enclave_to_host(regs, enclave, tid);
+  enclave->threads[tid].state = RUNNABLE;
   regs[10] = ENCLAVE_TIMER_IRQ;
+  report_switched_thread(regs, enclave, tid);
 
 timer_irq_out:
   spinlock_unlock(&enclave_metadata_lock);
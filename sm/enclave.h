@@ -9,12 +9,15 @@
 #include "atomic.h" 
 #include "mtrap.h"
 #include "thread.h"
+#include "swap.h"
 #include <stdint.h>
 #include <stddef.h>
 
 #define ENCLAVES_PER_METADATA_REGION 256
 #define ENCLAVE_METADATA_REGION_SIZE ((sizeof(struct enclave_t)) * ENCLAVES_PER_METADATA_REGION)
 
+#define ENCLAVE_MAX_THREADS 8
+
 struct link_mem_t
 {
   unsigned long mem_size;
@@ -32,8 +35,30 @@ typedef enum
   RUNNABLE,
   RUNNING,
   STOPPED, 
+  OCALLING,
 } enclave_state_t;
 
+/*
+ * Thread slot of an enclave, an unused slot is INVALID.
+ * A started thread goes through RUNNING/RUNNABLE/OCALLING on its own,
+ * while enclave_t.state only tells whether the enclave is FRESH,
+ * RUNNING (has been started) or STOPPED.
+ */
+struct enclave_thread_t
+{
+  enclave_state_t state;
+  //enclave called by this thread, -1 if there is none
+  int callee_eid;
+  //thread is waiting in a run queue of the security monitor
+  int queued;
+  //hart owning the thread, it can only be resumed there, -1 if none
+  int hart;
+  //deadline set by the thread itself and the number of them fired
+  uint64_t timer_deadline;
+  unsigned long timer_events;
+  struct thread_state_t context;
+};
+
 /*
  * enclave memory [paddr, paddr + size]
  * free_mem @ unused memory address in enclave mem
@@ -50,6 +75,23 @@ struct enclave_t
   //address of left available memory in memory region
   unsigned long free_mem;
 
+  //memory taken from the buddy system on page faults once free_mem
+  //is used up, extent_size is 0 if there is none
+  unsigned long extent_paddr;
+  unsigned long extent_size;
+  unsigned long extent_free;
+
+  //list of pages freed by swapping, linked through their first word
+  unsigned long free_pages;
+
+  //host memory holding swapped pages, swap_slots is 0 if there is none
+  struct swap_slot_t* swap_area;
+  unsigned long swap_slots;
+  unsigned long swap_next_slot;
+  //key id and the version of the last swapped page
+  unsigned long swap_id;
+  unsigned long swap_version;
+
   //TODO: dynamically allocated memory
   unsigned long* enclave_mem_metadata_page;
 
@@ -69,26 +111,66 @@ struct enclave_t
   unsigned long untrusted_ptr;
   unsigned long untrusted_size;
 
-  //enclave thread context
-  //TODO: support multiple threads
-  struct thread_state_t thread_context;
+  //caller of an enclave-to-enclave call served by thread0, -1 if there is none
+  int caller_eid;
+  int caller_tid;
+
+  //shared memory object attached by the enclave, -1 if there is none
+  int shm_id;
+  unsigned long shm_va;
+  unsigned long shm_paddr;
+  unsigned long shm_size;
+  unsigned long shm_perm;
+
+  //relay page owned by the enclave, relay_size is 0 if there is none
+  unsigned long relay_va;
+  unsigned long relay_paddr;
+  unsigned long relay_size;
+
+  //time slice in mtime ticks when scheduled by the security monitor,
+  //0 if the host schedules the enclave
+  unsigned long time_slice;
+
+  //enclave threads, they share the page table and memory access
+  struct enclave_thread_t threads[ENCLAVE_MAX_THREADS];
 };
 
 struct cpu_state_t
 {
   int in_enclave;
   int eid;
+  int tid;
+  //hart is parked in the enclave until it exits
+  int exclusive;
 };
 
 uintptr_t copy_from_host(void* dest, void* src, size_t size);
 uintptr_t copy_to_host(void* dest, void* src, size_t size);
 
+struct enclave_t* get_enclave(int eid);
+
 uintptr_t create_enclave(struct enclave_sbi_param_t create_args);
-uintptr_t run_enclave(uintptr_t* regs, unsigned int eid);
+uintptr_t run_enclave(uintptr_t* regs, unsigned int eid, unsigned int tid);
+uintptr_t run_enclave_exclusive(uintptr_t* regs, unsigned int eid, unsigned int tid);
 uintptr_t stop_enclave(uintptr_t* regs, unsigned int eid);
 uintptr_t resume_enclave(uintptr_t* regs, unsigned int eid);
 uintptr_t resume_from_stop(uintptr_t* regs, unsigned int eid);
 uintptr_t exit_enclave(uintptr_t* regs, unsigned long retval);
+uintptr_t enclave_ocall(uintptr_t* regs, uintptr_t ocall_func_id, uintptr_t arg0, uintptr_t arg1);
+uintptr_t resume_from_ocall(uintptr_t* regs, unsigned int eid);
+uintptr_t call_enclave(uintptr_t* regs, unsigned int callee_eid, uintptr_t arg0, uintptr_t arg1);
+uintptr_t enclave_return(uintptr_t* regs, uintptr_t retval);
+uintptr_t attach_shm(uintptr_t* regs, int shm_id, uintptr_t va);
+uintptr_t detach_shm(uintptr_t* regs);
+uintptr_t transfer_relay_page(unsigned int eid, uintptr_t paddr, uintptr_t va);
+uintptr_t return_relay_page(uintptr_t* regs);
+uintptr_t migrate_enclave(unsigned int eid, int tid, int dest_hart);
+uintptr_t set_enclave_time_slice(unsigned int eid, unsigned long time_slice);
+uintptr_t compact_enclave_memory(unsigned long budget);
+int enclave_page_fault(uintptr_t* regs, uintptr_t mcause, uintptr_t badaddr);
+uintptr_t evict_enclave_pages(unsigned int eid, struct swap_arg_t* swap_arg);
+uintptr_t yield_enclave(uintptr_t* regs, uintptr_t wake_hint);
+uintptr_t enclave_set_timer(uint64_t deadline);
 uintptr_t do_timer_irq(uintptr_t* regs, uintptr_t mcause, uintptr_t mepc);
 
 #endif /* _ENCLAVE_H */
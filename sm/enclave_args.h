@@ -9,6 +9,19 @@ struct mm_alloc_arg_t
   unsigned long resp_size;
 };
 
+/*
+ * Evict up to nr_pages cold pages of an enclave into swap_area, an array
+ * of nr_slots struct swap_slot_t in host memory. The first call binds the
+ * area to the enclave. resp_evicted is the number of pages evicted.
+ */
+struct swap_arg_t
+{
+  unsigned long swap_area;
+  unsigned long nr_slots;
+  unsigned long nr_pages;
+  unsigned long resp_evicted;
+};
+
 /*
  * enclave memory [paddr, paddr + size]
  * free_mem @ unused memory address in enclave mem
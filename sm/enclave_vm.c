@@ -0,0 +1,350 @@
+#include "enclave_vm.h"
+#include "sm.h"
+#include <string.h>
+
+static uintptr_t pte_to_paddr(pte_t pte)
+{
+  return ((pte & ENCLAVE_PTE_PPN_MASK) >> PTE_PPN_SHIFT) << RISCV_PGSHIFT;
+}
+
+static unsigned long pt_idx(uintptr_t va, int level)
+{
+  unsigned long idx = va >> (RISCV_PGLEVEL_BITS*level + RISCV_PGSHIFT);
+  return idx & ((1 << RISCV_PGLEVEL_BITS) - 1);
+}
+
+/*
+ * Allocate a zeroed page from the pages freed by swapping, the unused
+ * part of enclave's memory, i.e. [free_mem, paddr + size), and then
+ * from its extent if any.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+void* enclave_alloc_page(struct enclave_t* enclave)
+{
+  void* page;
+
+  if(enclave->free_pages)
+  {
+    page = (void*)enclave->free_pages;
+    enclave->free_pages = *(unsigned long*)page;
+  }
+  else if(enclave->free_mem >= enclave->paddr
+      && enclave->free_mem + RISCV_PGSIZE <= enclave->paddr + enclave->size)
+  {
+    page = (void*)enclave->free_mem;
+    enclave->free_mem += RISCV_PGSIZE;
+  }
+  else if(enclave->extent_size
+      && enclave->extent_free + RISCV_PGSIZE <= enclave->extent_paddr + enclave->extent_size)
+  {
+    page = (void*)enclave->extent_free;
+    enclave->extent_free += RISCV_PGSIZE;
+  }
+  else
+  {
+    return NULL;
+  }
+  memset(page, 0, RISCV_PGSIZE);
+
+  return page;
+}
+
+//give a page of enclave's own memory back for enclave_alloc_page
+void enclave_free_page(struct enclave_t* enclave, void* page)
+{
+  memset(page, 0, RISCV_PGSIZE);
+  *(unsigned long*)page = enclave->free_pages;
+  enclave->free_pages = (unsigned long)page;
+}
+
+int enclave_owns_page(struct enclave_t* enclave, uintptr_t paddr)
+{
+  if(paddr >= enclave->paddr && paddr < enclave->paddr + enclave->size)
+    return 1;
+  if(enclave->extent_size && paddr >= enclave->extent_paddr
+      && paddr < enclave->extent_paddr + enclave->extent_size)
+    return 1;
+  return 0;
+}
+
+//size of the leaf mapped by a pte at level, 0 is the 4 KiB level
+#define LEVEL_SIZE(level) (1UL << (RISCV_PGLEVEL_BITS*(level) + RISCV_PGSHIFT))
+
+static void* alloc_megapage_from(struct enclave_t* enclave, unsigned long* free, uintptr_t end)
+{
+  uintptr_t page = (*free + ENCLAVE_MEGAPAGE_SIZE - 1) & ~(ENCLAVE_MEGAPAGE_SIZE - 1);
+
+  if(page < *free || page + ENCLAVE_MEGAPAGE_SIZE > end)
+    return NULL;
+
+  //the pages skipped to reach the boundary are not lost
+  while(*free < page)
+  {
+    enclave_free_page(enclave, (void*)*free);
+    *free += RISCV_PGSIZE;
+  }
+  *free = page + ENCLAVE_MEGAPAGE_SIZE;
+  memset((void*)page, 0, ENCLAVE_MEGAPAGE_SIZE);
+
+  return (void*)page;
+}
+
+/*
+ * Allocate a zeroed 2 MiB aligned page from the unused part of enclave's
+ * memory and then from its extent if any. The extent is never grown here.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+void* enclave_alloc_megapage(struct enclave_t* enclave)
+{
+  void* page = NULL;
+
+  if(enclave->free_mem >= enclave->paddr)
+    page = alloc_megapage_from(enclave, &enclave->free_mem, enclave->paddr + enclave->size);
+  if(!page && enclave->extent_size)
+    page = alloc_megapage_from(enclave, &enclave->extent_free, enclave->extent_paddr + enclave->extent_size);
+
+  return page;
+}
+
+/*
+ * Walk enclave's page table down to the pte of va at *level.
+ * A superpage leaf met during the walk is returned as it is,
+ * with *level set to the level of the leaf.
+ * Missing page table pages are allocated if create is set.
+ */
+pte_t* enclave_walk_level(struct enclave_t* enclave, uintptr_t va, int* level, int create)
+{
+  pte_t* t = (pte_t*)enclave->root_page_table;
+  int i;
+
+  for(i = ENCLAVE_PT_LEVELS - 1; i > *level; i--)
+  {
+    pte_t* pte = &t[pt_idx(va, i)];
+    if(!(*pte & PTE_V))
+    {
+      if(!create)
+        return NULL;
+      void* page = enclave_alloc_page(enclave);
+      if(!page)
+        return NULL;
+      *pte = ptd_create((uintptr_t)page >> RISCV_PGSHIFT);
+    }
+    else if(!PTE_TABLE(*pte))
+    {
+      *level = i;
+      return pte;
+    }
+    t = (pte_t*)pte_to_paddr(*pte);
+  }
+
+  return &t[pt_idx(va, *level)];
+}
+
+/*
+ * Walk enclave's page table and return the pte of va.
+ * A superpage leaf is returned as it is when met during the walk.
+ * Missing page table pages are allocated if create is set.
+ */
+pte_t* enclave_walk(struct enclave_t* enclave, uintptr_t va, int create)
+{
+  int level = 0;
+
+  return enclave_walk_level(enclave, va, &level, create);
+}
+
+/*
+ * Map [va, va + size) to paddr, with the largest leaves (up to 1 GiB)
+ * both addresses are aligned to and the rest of the range can hold.
+ */
+int enclave_map_range(struct enclave_t* enclave, uintptr_t va, uintptr_t paddr, unsigned long size, uintptr_t type)
+{
+  uintptr_t off;
+  int level, want;
+
+  if((va | paddr | size) & (RISCV_PGSIZE - 1))
+    return -1;
+
+  for(off = 0; off < size; off += LEVEL_SIZE(want))
+  {
+    pte_t* pte = NULL;
+
+    for(want = ENCLAVE_MAX_LEAF_LEVEL; want > 0; want--)
+    {
+      if(!(((va + off) | (paddr + off)) & (LEVEL_SIZE(want) - 1))
+          && size - off >= LEVEL_SIZE(want))
+        break;
+    }
+
+    //fall back to smaller leaves below an existing page table page
+    for(; want >= 0; want--)
+    {
+      level = want;
+      pte = enclave_walk_level(enclave, va + off, &level, 1);
+      if(!pte || level != want || !(*pte & PTE_V) || !PTE_TABLE(*pte))
+        break;
+    }
+
+    if(!pte || level != want || (*pte & PTE_V))
+    {
+      printm("M mode: enclave_map_range: can not map va 0x%lx\r\n", va + off);
+      enclave_unmap_range(enclave, va, off);
+      return -1;
+    }
+    *pte = pte_create((paddr + off) >> RISCV_PGSHIFT, type);
+  }
+
+  return 0;
+}
+
+/*
+ * Unmap [va, va + size). A superpage leaf is only cleared when it is
+ * fully covered by the range, as enclave_map_range maps it that way.
+ */
+int enclave_unmap_range(struct enclave_t* enclave, uintptr_t va, unsigned long size)
+{
+  uintptr_t off, step;
+  int level;
+
+  for(off = 0; off < size; off += step)
+  {
+    level = 0;
+    pte_t* pte = enclave_walk_level(enclave, va + off, &level, 0);
+    step = LEVEL_SIZE(level) - ((va + off) & (LEVEL_SIZE(level) - 1));
+    if(!pte)
+      continue;
+    if(step != LEVEL_SIZE(level) || size - off < step)
+    {
+      printm("M mode: enclave_unmap_range: va 0x%lx is in a larger page\r\n", va + off);
+      continue;
+    }
+    *pte = 0;
+  }
+
+  return 0;
+}
+
+static void rebase_page_table(struct enclave_t* enclave, pte_t* t, int level, uintptr_t old_paddr)
+{
+  int i;
+
+  for(i = 0; i < (1 << RISCV_PGLEVEL_BITS); ++i)
+  {
+    uintptr_t paddr = pte_to_paddr(t[i]);
+
+    if(!(t[i] & PTE_V))
+      continue;
+
+    if(paddr >= old_paddr && paddr < old_paddr + enclave->size)
+    {
+      paddr = paddr - old_paddr + enclave->paddr;
+      t[i] = ((paddr >> RISCV_PGSHIFT) << PTE_PPN_SHIFT) | (t[i] & ~ENCLAVE_PTE_PPN_MASK);
+    }
+
+    //page table pages in the extent may point into the old block as well
+    if(PTE_TABLE(t[i]) && level > 0 && enclave_owns_page(enclave, paddr))
+      rebase_page_table(enclave, (pte_t*)paddr, level - 1, old_paddr);
+  }
+}
+
+/*
+ * Fix up enclave's page table after its memory has been copied from
+ * old_paddr to enclave->paddr. Every page table page the enclave owns is
+ * visited, wherever it lives, and only the ptes pointing into the old
+ * block are moved, those of the extent, untrusted or shared memory are kept.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+void enclave_rebase_page_table(struct enclave_t* enclave, uintptr_t old_paddr)
+{
+  rebase_page_table(enclave, (pte_t*)enclave->root_page_table, ENCLAVE_PT_LEVELS - 1, old_paddr);
+}
+
+static int walk_page_table(struct enclave_t* enclave, pte_t* t, int level, uintptr_t va,
+    enclave_pte_fn fn, void* arg)
+{
+  int i, retval;
+
+  for(i = 0; i < (1 << RISCV_PGLEVEL_BITS); ++i)
+  {
+    uintptr_t cur_va = va | ((uintptr_t)i << (RISCV_PGLEVEL_BITS*level + RISCV_PGSHIFT));
+
+    //sign extend the upper half of the address space
+    if(level == ENCLAVE_PT_LEVELS - 1 && (i & (1 << (RISCV_PGLEVEL_BITS - 1))))
+      cur_va |= -1UL << VA_BITS;
+
+    if(!(t[i] & PTE_V))
+      continue;
+
+    if(PTE_TABLE(t[i]))
+    {
+      //never follow the page table out of enclave's memory
+      if(level == 0 || !enclave_owns_page(enclave, pte_to_paddr(t[i])))
+        continue;
+      retval = walk_page_table(enclave, (pte_t*)pte_to_paddr(t[i]), level - 1, cur_va, fn, arg);
+    }
+    else if(level == 0)
+    {
+      retval = fn(enclave, cur_va, &t[i], arg);
+    }
+    else
+    {
+      continue;
+    }
+
+    if(retval)
+      return retval;
+  }
+
+  return 0;
+}
+
+/*
+ * Call fn on every valid 4 KiB leaf pte of enclave's page table until it
+ * returns non-zero, which is then returned.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+int enclave_for_each_page(struct enclave_t* enclave, enclave_pte_fn fn, void* arg)
+{
+  return walk_page_table(enclave, (pte_t*)enclave->root_page_table, ENCLAVE_PT_LEVELS - 1, 0, fn, arg);
+}
+
+static int verify_page_table(struct enclave_t* enclave, pte_t* t, int level)
+{
+  int i;
+
+  for(i = 0; i < (1 << RISCV_PGLEVEL_BITS); ++i)
+  {
+    uintptr_t paddr = pte_to_paddr(t[i]);
+
+    if(!(t[i] & PTE_V))
+      continue;
+
+    if(PTE_TABLE(t[i]))
+    {
+      //page table pages must be out of the reach of the host
+      if(level == 0 || !enclave_owns_page(enclave, paddr)
+          || verify_page_table(enclave, (pte_t*)paddr, level - 1) < 0)
+        return -1;
+      continue;
+    }
+
+    //a leaf is either fully in enclave's memory or fully out of it,
+    //and a superpage leaf must be aligned to its size
+    if(level > ENCLAVE_MAX_LEAF_LEVEL || (paddr & (LEVEL_SIZE(level) - 1)))
+      return -1;
+    if(region_overlap(paddr, LEVEL_SIZE(level), enclave->paddr, enclave->size)
+        && !region_contain(enclave->paddr, enclave->size, paddr, LEVEL_SIZE(level)))
+      return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Check the page table built by the host for a new enclave. 4 KiB, 2 MiB
+ * and 1 GiB leaves are all accepted.
+ * Remember to acquire enclave_metadata_lock before calling this function.
+ */
+int enclave_verify_page_table(struct enclave_t* enclave)
+{
+  return verify_page_table(enclave, (pte_t*)enclave->root_page_table, ENCLAVE_PT_LEVELS - 1);
+}
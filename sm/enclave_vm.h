@@ -0,0 +1,50 @@
+#ifndef _ENCLAVE_VM_H
+#define _ENCLAVE_VM_H
+
+#include <stdint.h>
+#include "vm.h"
+#include "enclave.h"
+
+#define ENCLAVE_PT_LEVELS ((VA_BITS - RISCV_PGSHIFT) / RISCV_PGLEVEL_BITS)
+
+//ppn field of a pte, the bits above it (PBMT, N) are not part of the address
+#if __riscv_xlen == 64
+#define ENCLAVE_PTE_PPN_MASK (((1UL << 44) - 1) << PTE_PPN_SHIFT)
+#else
+#define ENCLAVE_PTE_PPN_MASK (-1UL << PTE_PPN_SHIFT)
+#endif
+
+//highest level of a leaf pte, i.e. 1 GiB pages
+#define ENCLAVE_MAX_LEAF_LEVEL 2
+
+//size of a level 1 leaf
+#define ENCLAVE_MEGAPAGE_SIZE (RISCV_PGSIZE << RISCV_PGLEVEL_BITS)
+
+//pte type of pages mapped by the security monitor for an enclave
+#define ENCLAVE_PTE_TYPE(perm) (PTE_U | PTE_A | PTE_D | ((perm) & (PTE_R | PTE_W | PTE_X)))
+
+typedef int (*enclave_pte_fn)(struct enclave_t* enclave, uintptr_t va, pte_t* pte, void* arg);
+
+void* enclave_alloc_page(struct enclave_t* enclave);
+
+void* enclave_alloc_megapage(struct enclave_t* enclave);
+
+void enclave_free_page(struct enclave_t* enclave, void* page);
+
+int enclave_owns_page(struct enclave_t* enclave, uintptr_t paddr);
+
+pte_t* enclave_walk_level(struct enclave_t* enclave, uintptr_t va, int* level, int create);
+
+pte_t* enclave_walk(struct enclave_t* enclave, uintptr_t va, int create);
+
+int enclave_map_range(struct enclave_t* enclave, uintptr_t va, uintptr_t paddr, unsigned long size, uintptr_t type);
+
+int enclave_unmap_range(struct enclave_t* enclave, uintptr_t va, unsigned long size);
+
+void enclave_rebase_page_table(struct enclave_t* enclave, uintptr_t old_paddr);
+
+int enclave_for_each_page(struct enclave_t* enclave, enclave_pte_fn fn, void* arg);
+
+int enclave_verify_page_table(struct enclave_t* enclave);
+
+#endif /* _ENCLAVE_VM_H */
@@ -3,47 +3,184 @@
 #include "disabled_hart_mask.h"
 #include "ipi.h"
 
-//remember to acquire ipi_mail_lock before using this data struct
-struct ipi_mail_t ipi_mail = {0,};
+static ipi_handler_t ipi_handlers[IPI_MAX_EVENTS];
 
-spinlock_t ipi_mail_lock = SPINLOCK_INIT;
+static struct ipi_mailbox_t ipi_mailboxes[MAX_HARTS];
 
-//remember to acquire ipi_mail_lock before using this function
-void send_and_sync_ipi_mail(uintptr_t dest_hart)
+//ipi_seen[i][j] is the last request of hart j seen by hart i, only written by hart i
+static unsigned long ipi_seen[MAX_HARTS][MAX_HARTS];
+
+static int is_ipi_mail_target(const hartmask_t* mask, uintptr_t hart)
+{
+  return hartmask_test(mask, hart) && !hartmask_test(&disabled_hart_mask, hart)
+    && (hart != read_csr(mhartid));
+}
+
+/*
+ * Called in every loop of a hart waiting for others. It handles the mails
+ * and the remote sfence.vma others may wait for, and clears its msip for
+ * a hart polling it in send_ipi_many. The IPIs consumed are kept in
+ * incoming and restored by ipi_wait_done, so they are still taken once
+ * the wait is over.
+ */
+void ipi_wait_poll(uintptr_t* incoming)
+{
+  *incoming |= atomic_swap(HLS()->ipi, 0);
+  flush_pending_sfence_vma();
+  handle_ipi_mail();
+}
+
+void ipi_wait_done(uintptr_t incoming)
+{
+  //if we got an IPI, restore it
+  if(incoming)
+  {
+    *HLS()->ipi = incoming;
+    mb();
+  }
+}
+
+int register_ipi_handler(uintptr_t event, ipi_handler_t handler)
 {
+  if(event >= IPI_MAX_EVENTS)
+  {
+    printm("M mode: register_ipi_handler: invalid event %lx\r\n", event);
+    return -1;
+  }
+
+  ipi_handlers[event] = handler;
+  mb();
+
+  return 0;
+}
+
+/*
+ * Post a request of event to all other harts in dest_hart and return its
+ * ticket. With IPI_WAIT_ALL, wait until all of them have completed it,
+ * otherwise wait_ipi_rpc(ticket) can be used later. Requests sent to
+ * current hart by others meanwhile are handled while waiting, so two
+ * harts sending to each other at the same time do not wait forever.
+ */
+unsigned long post_ipi_rpc(const hartmask_t* dest_hart, uintptr_t event,
+    void* payload, unsigned long size, int mode)
+{
+  struct ipi_mailbox_t* mailbox = &ipi_mailboxes[read_csr(mhartid)];
+  hartmask_t mask = hart_mask;
+  unsigned long seq = mailbox->head + 1;
+  struct ipi_rpc_t* rpc = &mailbox->ring[seq % IPI_RING_SLOTS];
+  long pending = 0;
+  uintptr_t incoming_ipi = 0;
+  uintptr_t i;
+
+  if(dest_hart)
+    hartmask_and(&mask, &mask, dest_hart);
+  if(size > IPI_PAYLOAD_SIZE)
+  {
+    printm("M mode: post_ipi_rpc: payload of event %lx is too large\r\n", event);
+    return 0;
+  }
+
+  //a slot is reused once every target has completed the request in it
+  while(rpc->pending)
+    ipi_wait_poll(&incoming_ipi);
+  ipi_wait_done(incoming_ipi);
+
+  for_each_hart(i, &mask)
+  {
+    if(is_ipi_mail_target(&mask, i))
+      pending++;
+  }
+
+  //a target skips the slot while seq does not match
+  rpc->seq = 0;
+  mb();
+  rpc->event = event;
+  rpc->dest_mask = mask;
+  rpc->pending = pending;
+  memcpy(rpc->payload, payload, size);
+  mb();
+  rpc->seq = seq;
+  mb();
+  mailbox->head = seq;
+  mb();
+
   //send IPIs to every other hart
-  uintptr_t mask = hart_mask;
-  mask &= dest_hart;
-  for(uintptr_t i=0, m = mask; m; ++i, m>>=1)
+  for_each_hart(i, &mask)
   {
-    if((m & 1) && (!((disabled_hart_mask >> i) & 1))
-        && (i != read_csr(mhartid)))
+    if(is_ipi_mail_target(&mask, i))
     {
-      //printm("hart%d: send to hart %d\r\n", read_csr(mhartid), i);
       atomic_or(&OTHER_HLS(i)->mipi_pending, IPI_MAIL);
       mb();
       *OTHER_HLS(i)->ipi = 1;
     }
   }
 
-  //wait until all other harts have handled IPI
+  if(mode == IPI_WAIT_ALL)
+    wait_ipi_rpc(seq);
+
+  return seq;
+}
+
+//wait until a request posted by current hart has been completed by all targets
+void wait_ipi_rpc(unsigned long ticket)
+{
+  struct ipi_rpc_t* rpc = &ipi_mailboxes[read_csr(mhartid)].ring[ticket % IPI_RING_SLOTS];
   uintptr_t incoming_ipi = 0;
-  for(uintptr_t i=0, m=mask; m; ++i, m>>=1)
+
+  //the slot is only reused after the request in it is completed
+  while(rpc->seq == ticket && rpc->pending)
+    ipi_wait_poll(&incoming_ipi);
+  ipi_wait_done(incoming_ipi);
+  mb();
+}
+
+static void handle_ipi_rpc(int sender, struct ipi_rpc_t* rpc, unsigned long seq)
+{
+  uintptr_t hart = read_csr(mhartid);
+  uintptr_t event;
+  hartmask_t dest_mask;
+  char payload[IPI_PAYLOAD_SIZE];
+
+  //the slot has been reused by a later request not aimed at current hart
+  if(rpc->seq != seq)
+    return;
+  mb();
+  event = rpc->event;
+  dest_mask = rpc->dest_mask;
+  memcpy(payload, rpc->payload, IPI_PAYLOAD_SIZE);
+  mb();
+  if(rpc->seq != seq || !hartmask_test(&dest_mask, hart))
+    return;
+
+  if(event < IPI_MAX_EVENTS && ipi_handlers[event])
+    ipi_handlers[event](sender, payload);
+  else
+    printm("M mode: handle_ipi_mail: no handler for event %lx\r\n", event);
+
+  mb();
+  atomic_add(&rpc->pending, -1);
+}
+
+//handle the requests of all senders pending on current hart in order
+void handle_ipi_mail()
+{
+  uintptr_t hart = read_csr(mhartid);
+  struct ipi_mailbox_t* mailbox;
+  unsigned long seq;
+  int sender;
+
+  for(sender = 0; sender < MAX_HARTS; ++sender)
   {
-    if((m & 1) && (!((disabled_hart_mask >> i) & 1))
-        && (i != read_csr(mhartid)))
+    if(sender == hart)
+      continue;
+
+    mailbox = &ipi_mailboxes[sender];
+    while(ipi_seen[hart][sender] != mailbox->head)
     {
-      while(*OTHER_HLS(i)->ipi)
-      {
-        incoming_ipi |= atomic_swap(HLS()->ipi, 0);
-      }
+      mb();
+      seq = ipi_seen[hart][sender] + 1;
+      handle_ipi_rpc(sender, &mailbox->ring[seq % IPI_RING_SLOTS], seq);
+      ipi_seen[hart][sender] = seq;
     }
   }
-
-  //if we got an IPI, restore it
-  if(incoming_ipi)
-  {
-    *HLS()->ipi = incoming_ipi;
-    mb();
-  }
 }
@@ -2,21 +2,65 @@
 #define _IPI_H
 
 #include "atomic.h"
-
-#define IPI_PMP_SYNC     0x1
-#include "atomic.h" 
 #include <string.h>
 #include "stdint.h"
-struct ipi_mail_t
+#include "mtrap.h"
+#include "hartmask.h"
+
+/*
+ * Typed IPI RPCs between harts
+ *
+ * A handler is registered per event and runs on every target hart with
+ * the typed payload the sender posted. Each sending hart owns a small
+ * ring of requests, only written by itself, so harts can have requests
+ * in flight at the same time. A request counts down the targets that
+ * have not completed it yet, the sender only polls that counter.
+ */
+#define IPI_PMP_SYNC        0x1
+#define IPI_PMP_RESIZE      0x2
+#define IPI_MAX_EVENTS      16
+
+#define IPI_PAYLOAD_SIZE    40
+#define IPI_RING_SLOTS      4
+
+//mode of an IPI RPC
+#define IPI_WAIT_ALL        0
+#define IPI_NO_WAIT         1
+
+//sender is the hart posting the request
+typedef void (*ipi_handler_t)(int sender, void* payload);
+
+struct ipi_rpc_t
 {
+  volatile unsigned long seq;
   uintptr_t event;
-  char data[40];
+  hartmask_t dest_mask;
+  volatile long pending;
+  char payload[IPI_PAYLOAD_SIZE];
 };
 
-extern struct ipi_mail_t ipi_mail;
+struct ipi_mailbox_t
+{
+  struct ipi_rpc_t ring[IPI_RING_SLOTS];
+  volatile unsigned long head;
+};
+
+int register_ipi_handler(uintptr_t event, ipi_handler_t handler);
+
+unsigned long post_ipi_rpc(const hartmask_t* dest_hart, uintptr_t event,
+    void* payload, unsigned long size, int mode);
+
+void wait_ipi_rpc(unsigned long ticket);
+
+void ipi_wait_poll(uintptr_t* incoming);
+
+void ipi_wait_done(uintptr_t incoming);
 
-extern spinlock_t ipi_mail_lock;
+//dest_hart of NULL selects all harts, payload points to the typed payload of event
+#define send_ipi_rpc(dest_hart, event, payload, mode) ({ \
+  _Static_assert(sizeof(*(payload)) <= IPI_PAYLOAD_SIZE, "IPI payload too large"); \
+  post_ipi_rpc(dest_hart, event, payload, sizeof(*(payload)), mode); })
 
-void send_and_sync_ipi_mail(uintptr_t dest_hart);
+void handle_ipi_mail();
 
 #endif /* _IPI_H */
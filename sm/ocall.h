@@ -0,0 +1,64 @@
+#ifndef _OCALL_H
+#define _OCALL_H
+
+/*
+ * Exitless ocall ring
+ *
+ * The ring lives at the beginning of the untrusted memory shared between
+ * an enclave and its host (untrusted_ptr/untrusted_size). The enclave
+ * posts requests into it and a host worker thread running on another
+ * hart services them, so no world switch is needed for an ocall.
+ *
+ * Enclave (producer):
+ *   slot = atomic_add(&ring->head, 1) % OCALL_RING_SLOTS
+ *   wait until slots[slot].state == OCALL_SLOT_FREE
+ *   fill func_id/arg0/arg1/syscall_num, fence
+ *   slots[slot].state = OCALL_SLOT_POSTED
+ *   wait until slots[slot].state == OCALL_SLOT_DONE, read retval
+ *   slots[slot].state = OCALL_SLOT_FREE
+ *
+ * Host worker (consumer):
+ *   slot = ring->tail % OCALL_RING_SLOTS
+ *   wait until slots[slot].state == OCALL_SLOT_POSTED
+ *   service the request, fill retval, fence
+ *   slots[slot].state = OCALL_SLOT_DONE, ring->tail++
+ *
+ * If the host worker is not polling (ring->worker_active == 0) the
+ * enclave falls back to SBI_ENCLAVE_OCALL with OCALL_RING_KICK, which
+ * exits to the host through the normal ocall path and lets it drain
+ * the ring before resuming the enclave with RESUME_FROM_OCALL.
+ */
+
+#define OCALL_RING_MAGIC        0x4f43524eUL
+#define OCALL_RING_SLOTS        64
+
+//state of an ocall slot
+#define OCALL_SLOT_FREE         0
+#define OCALL_SLOT_POSTED       1
+#define OCALL_SLOT_DONE         2
+
+//reserved ocall function id: ask the host to drain the ocall ring
+#define OCALL_RING_KICK         0xffffUL
+
+struct ocall_req_t
+{
+  volatile unsigned long state;
+  unsigned long func_id;
+  unsigned long arg0;
+  unsigned long arg1;
+  unsigned long syscall_num;
+  unsigned long retval;
+};
+
+struct ocall_ring_t
+{
+  unsigned long magic;
+  volatile unsigned long head;
+  volatile unsigned long tail;
+  volatile unsigned long worker_active;
+  struct ocall_req_t slots[OCALL_RING_SLOTS];
+};
+
+#define OCALL_RING_SIZE (sizeof(struct ocall_ring_t))
+
+#endif /* _OCALL_H */
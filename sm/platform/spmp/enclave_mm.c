@@ -6,10 +6,11 @@
 #include "math.h"
 
 /* 
- * Only NPMP-3 enclave regions are supported.
+ * Only NPMP-4 enclave regions are supported.
  * The last PMP is used to allow kernel to access memory.
  * The second to last PMP is used to protect security monitor from kernel.
  * The first PMP is used to allow kernel to configure enclave's page table.
+ * The second PMP is used to allow kernel to access the relay page.
  *
  * TODO: this array can be removed as we can get 
  * existing enclave regions via pmp registers
@@ -88,92 +89,237 @@ int retrieve_kernel_access(void* req_paddr, unsigned long size)
   return 0;
 }
 
-//grant enclave access to enclave's memory
-int grant_enclave_access(struct enclave_t* enclave)
+/*
+ * This function grants kernel access to the relay page,
+ * which is then owned by the host.
+ */
+int grant_relay_access(void* req_paddr, unsigned long size)
 {
-  int region_idx = 0;
-  int pmp_idx = 0;
   struct pmp_config_t pmp_config;
-  struct spmp_config_t spmp_config;
+  uintptr_t paddr = (uintptr_t)req_paddr;
 
-  if(check_mem_size(enclave->paddr, enclave->size) < 0)
+  if(check_mem_size(paddr, size) != 0)
     return -1;
 
-  //set pmp permission, ensure that enclave's paddr and size is pmp legal
-  //TODO: support multiple memory regions
-  spinlock_lock(&pmp_bitmap_lock);
+  pmp_config.paddr = paddr;
+  pmp_config.size = size;
+  pmp_config.perm = PMP_R | PMP_W;
+  pmp_config.mode = PMP_NAPOT;
+  set_pmp_and_sync(RELAY_PMP_IDX, pmp_config);
+
+  return 0;
+}
+
+/*
+ * This function retrieves kernel access to the relay page
+ * on every hart before it is handed to an enclave or freed.
+ */
+int retrieve_relay_access(void* req_paddr, unsigned long size)
+{
+  struct pmp_config_t pmp_config;
+  uintptr_t paddr = (uintptr_t)req_paddr;
+
+  pmp_config = get_pmp(RELAY_PMP_IDX);
+
+  if((pmp_config.mode != PMP_NAPOT) || (pmp_config.paddr != paddr) || (pmp_config.size != size))
+  {
+    printm("retrieve_relay_access: error pmp_config\r\n");
+    return -1;
+  }
+
+  clear_pmp_and_sync(RELAY_PMP_IDX);
+
+  return 0;
+}
+
+//remember to acquire pmp_bitmap_lock before calling this function
+static int find_mm_region(uintptr_t paddr, unsigned long size)
+{
+  int region_idx;
+
   for(region_idx = 0; region_idx < N_PMP_REGIONS; ++region_idx)
   {
     if(mm_regions[region_idx].valid && region_contain(
           mm_regions[region_idx].paddr, mm_regions[region_idx].size,
-          enclave->paddr, enclave->size))
+          paddr, size))
     {
-      break;
+      return region_idx;
     }
   }
+
+  return -1;
+}
+
+/*
+ * Collect the mm_regions holding enclave's memory and the memory
+ * attached to it in a bitmap of region index.
+ */
+static int get_enclave_regions(struct enclave_t* enclave, unsigned long* region_mask)
+{
+  int region_idx;
+
+  *region_mask = 0;
+
+  spinlock_lock(&pmp_bitmap_lock);
+
+  region_idx = find_mm_region(enclave->paddr, enclave->size);
+  if(region_idx < 0)
+    goto fail;
+  *region_mask |= 1UL << region_idx;
+
+  if(enclave->shm_size)
+  {
+    region_idx = find_mm_region(enclave->shm_paddr, enclave->shm_size);
+    if(region_idx < 0)
+      goto fail;
+    *region_mask |= 1UL << region_idx;
+  }
+
+  if(enclave->relay_size)
+  {
+    region_idx = find_mm_region(enclave->relay_paddr, enclave->relay_size);
+    if(region_idx < 0)
+      goto fail;
+    *region_mask |= 1UL << region_idx;
+  }
+
+  if(enclave->extent_size)
+  {
+    region_idx = find_mm_region(enclave->extent_paddr, enclave->extent_size);
+    if(region_idx < 0)
+      goto fail;
+    *region_mask |= 1UL << region_idx;
+  }
+
   spinlock_unlock(&pmp_bitmap_lock);
+  return 0;
 
-  if(region_idx >= N_PMP_REGIONS)
+fail:
+  spinlock_unlock(&pmp_bitmap_lock);
+  return -1;
+}
+
+//grant enclave access to enclave's memory
+int grant_enclave_access(struct enclave_t* enclave)
+{
+  int region_idx = 0;
+  int spmp_idx = LAST_REGION_SPMP;
+  unsigned long region_mask = 0;
+  struct pmp_config_t pmp_config;
+  struct spmp_config_t spmp_config;
+
+  if(check_mem_size(enclave->paddr, enclave->size) < 0)
+    return -1;
+
+  //ensure that enclave's paddr and size is pmp legal
+  if(get_enclave_regions(enclave, &region_mask) < 0)
   {
     printm("M mode: grant_enclave_access: can not find exact mm_region\r\n");
     return -1;
   }
 
-  pmp_idx = REGION_TO_PMP(region_idx);
-  pmp_config.paddr = mm_regions[region_idx].paddr;
-  pmp_config.size = mm_regions[region_idx].size;
-  pmp_config.perm = PMP_R | PMP_W | PMP_X;
-  pmp_config.mode = PMP_NAPOT;
-  set_pmp(pmp_idx, pmp_config);
-
   spmp_config.paddr = enclave->paddr;
   spmp_config.size = enclave->size;
   spmp_config.perm = SPMP_R | SPMP_W | SPMP_X;
   spmp_config.mode = SPMP_NAPOT;
-  set_spmp(0, spmp_config);
+  set_spmp(ENCLAVE_SPMP_IDX, spmp_config);
 
-  spmp_config.paddr = mm_regions[region_idx].paddr;
-  spmp_config.size = mm_regions[region_idx].size;
-  spmp_config.perm = SPMP_NO_PERM;
-  spmp_config.mode = SPMP_NAPOT;
-  set_spmp(1, spmp_config);
+  if(enclave->shm_size)
+  {
+    spmp_config.paddr = enclave->shm_paddr;
+    spmp_config.size = enclave->shm_size;
+    spmp_config.perm = enclave->shm_perm & (SPMP_R | SPMP_W);
+    spmp_config.mode = SPMP_NAPOT;
+    set_spmp(SHM_SPMP_IDX, spmp_config);
+  }
+  else
+  {
+    clear_spmp(SHM_SPMP_IDX);
+  }
 
-  return 0;
-}
+  if(enclave->relay_size)
+  {
+    spmp_config.paddr = enclave->relay_paddr;
+    spmp_config.size = enclave->relay_size;
+    spmp_config.perm = SPMP_R | SPMP_W;
+    spmp_config.mode = SPMP_NAPOT;
+    set_spmp(RELAY_SPMP_IDX, spmp_config);
+  }
+  else
+  {
+    clear_spmp(RELAY_SPMP_IDX);
+  }
 
-int retrieve_enclave_access(struct enclave_t *enclave)
-{
-  int region_idx = 0;
-  int pmp_idx = 0;
-  struct pmp_config_t pmp_config;
+  if(enclave->extent_size)
+  {
+    spmp_config.paddr = enclave->extent_paddr;
+    spmp_config.size = enclave->extent_size;
+    spmp_config.perm = SPMP_R | SPMP_W | SPMP_X;
+    spmp_config.mode = SPMP_NAPOT;
+    set_spmp(EXTENT_SPMP_IDX, spmp_config);
+  }
+  else
+  {
+    clear_spmp(EXTENT_SPMP_IDX);
+  }
 
-  //set pmp permission, ensure that enclave's paddr and size is pmp legal
-  //TODO: support multiple memory regions
-  spinlock_lock(&pmp_bitmap_lock);
+  //open every mm_region the enclave touches with pmp
+  //and close the rest of them with sPMP
   for(region_idx = 0; region_idx < N_PMP_REGIONS; ++region_idx)
   {
-    if(mm_regions[region_idx].valid && region_contain(
-          mm_regions[region_idx].paddr, mm_regions[region_idx].size,
-          enclave->paddr, enclave->size))
+    if(!(region_mask & (1UL << region_idx)))
+      continue;
+
+    if(spmp_idx < FIRST_REGION_SPMP)
     {
-      break;
+      printm("M mode: grant_enclave_access: enclave spans too many mm_regions\r\n");
+      retrieve_enclave_access(enclave);
+      return -1;
     }
+
+    pmp_config.paddr = mm_regions[region_idx].paddr;
+    pmp_config.size = mm_regions[region_idx].size;
+    pmp_config.perm = PMP_R | PMP_W | PMP_X;
+    pmp_config.mode = PMP_NAPOT;
+    set_pmp(REGION_TO_PMP(region_idx), pmp_config);
+
+    spmp_config.paddr = mm_regions[region_idx].paddr;
+    spmp_config.size = mm_regions[region_idx].size;
+    spmp_config.perm = SPMP_NO_PERM;
+    spmp_config.mode = SPMP_NAPOT;
+    set_spmp(spmp_idx--, spmp_config);
   }
-  spinlock_unlock(&pmp_bitmap_lock);
 
-  if(region_idx >= N_PMP_REGIONS)
+  return 0;
+}
+
+int retrieve_enclave_access(struct enclave_t *enclave)
+{
+  int region_idx = 0;
+  int spmp_idx = 0;
+  unsigned long region_mask = 0;
+  struct pmp_config_t pmp_config;
+
+  if(get_enclave_regions(enclave, &region_mask) < 0)
   {
     printm("M mode: Error: retriece_enclave_access\r\n");
     return -1;
   }
 
-  pmp_idx = REGION_TO_PMP(region_idx);
-  pmp_config = get_pmp(pmp_idx);
-  pmp_config.perm = PMP_NO_PERM;
-  set_pmp(pmp_idx, pmp_config);
+  //close every region pmp, as mm_reclaim may have split the regions
+  //opened for the enclave into pmps not in region_mask any more
+  for(region_idx = 0; region_idx < N_PMP_REGIONS; ++region_idx)
+  {
+    pmp_config = get_pmp(REGION_TO_PMP(region_idx));
+    if(pmp_config.mode != PMP_NAPOT || pmp_config.perm == PMP_NO_PERM)
+      continue;
+
+    pmp_config.perm = PMP_NO_PERM;
+    set_pmp(REGION_TO_PMP(region_idx), pmp_config);
+  }
 
-  clear_spmp(0);
-  clear_spmp(1);
+  for(spmp_idx = 0; spmp_idx <= LAST_REGION_SPMP; ++spmp_idx)
+    clear_spmp(spmp_idx);
 
   return 0;
 }
@@ -206,6 +352,18 @@ int check_mem_overlap(uintptr_t paddr, unsigned long size)
   return 0;
 }
 
+//check that the security monitor can write host memory on behalf of the host
+int check_host_memory(uintptr_t paddr, unsigned long size)
+{
+  int retval;
+
+  spinlock_lock(&pmp_bitmap_lock);
+  retval = check_mem_overlap(paddr, size);
+  spinlock_unlock(&pmp_bitmap_lock);
+
+  return retval;
+}
+
 uintptr_t mm_init(uintptr_t paddr, unsigned long size)
 {
   uintptr_t retval = 0;
@@ -675,3 +833,224 @@ mm_free_out:
   spinlock_unlock(&pmp_bitmap_lock);
   return ret_val;
 }
+
+/*
+ * Return the largest free block (no smaller than min_size) of the buddy
+ * system to the host. A region that is entirely free is released with
+ * its pmp. Otherwise the region is split into the buddies of the block
+ * on the way up to the whole region, each one protected by its own pmp,
+ * so that the block is no longer covered by any pmp.
+ */
+int mm_reclaim(unsigned long min_size, uintptr_t* resp_paddr, unsigned long* resp_size)
+{
+  int ret_val = 0;
+  int region_idx = 0;
+  int best_idx = -1;
+  int free_pmps = 0;
+  unsigned long region_order = 0;
+  unsigned long order = 0;
+  uintptr_t paddr = 0;
+  unsigned long size = 0;
+  struct mm_list_head_t* mm_list_head = NULL;
+  struct mm_list_t* best_region = NULL;
+  struct mm_list_t* mm_region = NULL;
+  struct mm_list_t* free_list = NULL;
+
+  spinlock_lock(&pmp_bitmap_lock);
+
+  for(region_idx = 0; region_idx < N_PMP_REGIONS; ++region_idx)
+  {
+    if(!(pmp_bitmap & (1UL << REGION_TO_PMP(region_idx))))
+      free_pmps += 1;
+  }
+
+  //splitting a region of order n around a block of order k
+  //needs n-k-1 more pmps
+  for(region_idx = 0; region_idx < N_PMP_REGIONS; ++region_idx)
+  {
+    if(!mm_regions[region_idx].valid || !mm_regions[region_idx].mm_list_head)
+      continue;
+
+    region_order = ilog2(mm_regions[region_idx].size - 1) + 1;
+    mm_list_head = mm_regions[region_idx].mm_list_head;
+    while(mm_list_head->next_list_head)
+      mm_list_head = mm_list_head->next_list_head;
+
+    while(mm_list_head)
+    {
+      order = mm_list_head->order;
+      if((1UL << order) < min_size
+          || (best_region && order <= best_region->order))
+        break;
+      if(order == region_order || region_order - order - 1 <= free_pmps)
+      {
+        best_region = mm_list_head->mm_list;
+        best_idx = region_idx;
+        break;
+      }
+      mm_list_head = mm_list_head->prev_list_head;
+    }
+  }
+
+  if(!best_region)
+  {
+    ret_val = -1;
+    goto mm_reclaim_out;
+  }
+
+  paddr = (uintptr_t)MM_LIST_2_PADDR(best_region);
+  order = best_region->order;
+  size = 1UL << order;
+  region_order = ilog2(mm_regions[best_idx].size - 1) + 1;
+
+  //the whole region is free, release it together with its pmp
+  if(order == region_order)
+  {
+    clear_pmp_and_sync(REGION_TO_PMP(best_idx));
+    pmp_bitmap &= ~(1UL << REGION_TO_PMP(best_idx));
+    mm_regions[best_idx].valid = 0;
+    mm_regions[best_idx].paddr = 0;
+    mm_regions[best_idx].size = 0;
+    mm_regions[best_idx].mm_list_head = NULL;
+    goto mm_reclaim_out;
+  }
+
+  //take the rest of free blocks out of the region
+  while((mm_list_head = mm_regions[best_idx].mm_list_head))
+  {
+    mm_region = mm_list_head->mm_list;
+    delete_certain_region(best_idx, &mm_list_head, mm_region);
+    if(mm_region == best_region)
+      continue;
+    mm_region->prev_mm = NULL;
+    mm_region->next_mm = free_list;
+    free_list = mm_region;
+  }
+
+  //protect the buddies of the reclaimed block with new pmps, each one
+  //inheriting the permission of the region on every hart
+  region_idx = 0;
+  for(unsigned long i = order; i < region_order - 1; ++i)
+  {
+    uintptr_t piece_paddr = (paddr & ~((1UL << i) - 1)) ^ (1UL << i);
+
+    while(pmp_bitmap & (1UL << REGION_TO_PMP(region_idx)))
+      region_idx += 1;
+    pmp_bitmap |= 1UL << REGION_TO_PMP(region_idx);
+
+    resize_pmp_and_sync(REGION_TO_PMP(region_idx), REGION_TO_PMP(best_idx),
+        piece_paddr, 1UL << i);
+    mm_regions[region_idx].valid = 1;
+    mm_regions[region_idx].paddr = piece_paddr;
+    mm_regions[region_idx].size = 1UL << i;
+    mm_regions[region_idx].mm_list_head = NULL;
+  }
+
+  //the largest buddy stays in the old region
+  mm_regions[best_idx].paddr = (paddr & ~((1UL << (region_order - 1)) - 1)) ^ (1UL << (region_order - 1));
+  mm_regions[best_idx].size = 1UL << (region_order - 1);
+  resize_pmp_and_sync(REGION_TO_PMP(best_idx), REGION_TO_PMP(best_idx),
+      mm_regions[best_idx].paddr, mm_regions[best_idx].size);
+
+  //every free block fits in exactly one of the buddies
+  while(free_list)
+  {
+    mm_region = free_list;
+    free_list = free_list->next_mm;
+    mm_region->next_mm = NULL;
+    region_idx = find_mm_region((uintptr_t)MM_LIST_2_PADDR(mm_region), 1UL << mm_region->order);
+    if(region_idx < 0 || insert_mm_region(region_idx, mm_region, 0) < 0)
+      printm("M mode: mm_reclaim: lost free memory 0x%lx\r\n", MM_LIST_2_PADDR(mm_region));
+  }
+
+mm_reclaim_out:
+  spinlock_unlock(&pmp_bitmap_lock);
+
+  if(ret_val == 0)
+  {
+    //do not leak the buddy system's metadata to the host
+    memset((void*)paddr, 0, size);
+    *resp_paddr = paddr;
+    *resp_size = size;
+  }
+
+  return ret_val;
+}
+
+//remember to acquire pmp_bitmap_lock before calling this function
+static struct mm_list_t* find_free_block(int region_idx, uintptr_t paddr, int order)
+{
+  struct mm_list_head_t* mm_list_head = mm_regions[region_idx].mm_list_head;
+  struct mm_list_t* mm_region = NULL;
+
+  while(mm_list_head && mm_list_head->order < order)
+    mm_list_head = mm_list_head->next_list_head;
+  if(!mm_list_head || mm_list_head->order != order)
+    return NULL;
+
+  for(mm_region = mm_list_head->mm_list; mm_region; mm_region = mm_region->next_mm)
+  {
+    if((uintptr_t)MM_LIST_2_PADDR(mm_region) == paddr)
+      return mm_region;
+  }
+
+  return NULL;
+}
+
+/*
+ * Pick a new home for the allocated block [paddr, paddr + size) whose
+ * buddy is free: a free block of the same order whose own buddy is in
+ * use. Moving the block there lets its old place merge with the buddy
+ * without breaking any free block. The target is taken out of the buddy
+ * system, and the old block should be freed after it has been moved.
+ */
+int mm_alloc_compaction_target(uintptr_t paddr, unsigned long size, uintptr_t* target)
+{
+  int ret_val = -1;
+  int region_idx = 0;
+  int order = ilog2(size - 1) + 1;
+  struct mm_list_head_t* mm_list_head = NULL;
+  struct mm_list_t* mm_region = NULL;
+  uintptr_t region_paddr = 0;
+
+  if(check_mem_size(paddr, size) < 0)
+    return -1;
+
+  spinlock_lock(&pmp_bitmap_lock);
+
+  region_idx = find_mm_region(paddr, size);
+  if(region_idx < 0 || mm_regions[region_idx].size == size
+      || !find_free_block(region_idx, paddr ^ size, order))
+    goto compaction_target_out;
+
+  for(region_idx = 0; region_idx < N_PMP_REGIONS; ++region_idx)
+  {
+    if(!mm_regions[region_idx].valid || mm_regions[region_idx].size == size)
+      continue;
+
+    mm_list_head = mm_regions[region_idx].mm_list_head;
+    while(mm_list_head && mm_list_head->order < order)
+      mm_list_head = mm_list_head->next_list_head;
+    if(!mm_list_head || mm_list_head->order != order)
+      continue;
+
+    for(mm_region = mm_list_head->mm_list; mm_region; mm_region = mm_region->next_mm)
+    {
+      region_paddr = (uintptr_t)MM_LIST_2_PADDR(mm_region);
+      if(region_paddr != (paddr ^ size)
+          && !find_free_block(region_idx, region_paddr ^ size, order))
+        break;
+    }
+    if(mm_region)
+    {
+      delete_certain_region(region_idx, &mm_list_head, mm_region);
+      *target = region_paddr;
+      ret_val = 0;
+      break;
+    }
+  }
+
+compaction_target_out:
+  spinlock_unlock(&pmp_bitmap_lock);
+  return ret_val;
+}
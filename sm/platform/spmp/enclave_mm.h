@@ -5,10 +5,30 @@
 #include "pmp.h"
 #include "enclave.h"
 
-#define N_PMP_REGIONS (NPMP - 3)
-
-#define REGION_TO_PMP(region_idx) (region_idx + 1)
-#define PMP_TO_REGION(pmp_idx) (pmp_idx - 1)
+#define N_PMP_REGIONS (NPMP - 4)
+
+//pmp1 is used for allowing kernel to access the relay page
+#define RELAY_PMP_IDX 1
+
+#define REGION_TO_PMP(region_idx) (region_idx + 2)
+#define PMP_TO_REGION(pmp_idx) (pmp_idx - 2)
+
+/*
+ * sPMP layout while an enclave is running
+ * sPMP0: enclave's own memory
+ * sPMP1: shared memory object attached by the enclave
+ * sPMP2: relay page owned by the enclave
+ * sPMP3: extent of enclave's memory grown on page faults
+ * sPMP[FIRST_REGION_SPMP, NSPMP-2]: deny the rest of the mm_regions
+ *                                   opened by PMP for the enclave
+ * sPMP[NSPMP-1]: allow user to access the rest of memory
+ */
+#define ENCLAVE_SPMP_IDX     0
+#define SHM_SPMP_IDX         1
+#define RELAY_SPMP_IDX       2
+#define EXTENT_SPMP_IDX      3
+#define FIRST_REGION_SPMP    4
+#define LAST_REGION_SPMP     (NSPMP - 2)
 
 /* 
  * Layout of free memory chunk
@@ -56,12 +76,22 @@ int retrieve_kernel_access(void* paddr, unsigned long size);
 
 int retrieve_enclave_access(struct enclave_t *enclave);
 
+int grant_relay_access(void* paddr, unsigned long size);
+
+int retrieve_relay_access(void* paddr, unsigned long size);
+
+int check_host_memory(uintptr_t paddr, unsigned long size);
+
 uintptr_t mm_init(uintptr_t paddr, unsigned long size);
 
 void* mm_alloc(unsigned long req_size, unsigned long* resp_size);
 
 int mm_free(void* paddr, unsigned long size);
 
+int mm_reclaim(unsigned long min_size, uintptr_t* paddr, unsigned long* size);
+
+int mm_alloc_compaction_target(uintptr_t paddr, unsigned long size, uintptr_t* target);
+
 void print_buddy_system();
 
 #endif /* _ENCLAVE_MM_H */
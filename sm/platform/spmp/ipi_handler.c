@@ -1,21 +1,21 @@
 #include "ipi.h"
 #include "pmp.h"
 
-void handle_ipi_mail()
+static void handle_pmp_sync(int sender, void* payload)
 {
-  char* mail_data = ipi_mail.data;
-  int pmp_idx = 0;
-  struct pmp_config_t pmp_config;
-  //printm("hart%d: handle ipi event%x\r\n", read_csr(mhartid), ipi_mail.event);
+  struct pmp_sync_t* pmp_sync = payload;
 
-  switch(ipi_mail.event)
-  {
-    case IPI_PMP_SYNC:
-      pmp_config = *(struct pmp_config_t*)(ipi_mail.data);
-      pmp_idx = *(int*)((void*)ipi_mail.data + sizeof(struct pmp_config_t));
-      set_pmp(pmp_idx, pmp_config);
-      break;
-    default:
-        break;
-  }
+  set_pmp(pmp_sync->pmp_idx, pmp_sync->pmp_config);
+}
+
+static void handle_pmp_resize(int sender, void* payload)
+{
+  resize_pmp(*(struct pmp_resize_t*)payload);
+}
+
+//the handler table is shared, every hart registering the same ones is harmless
+void platform_register_ipi_handlers()
+{
+  register_ipi_handler(IPI_PMP_SYNC, handle_pmp_sync);
+  register_ipi_handler(IPI_PMP_RESIZE, handle_pmp_resize);
 }
@@ -1,6 +1,6 @@
 #ifndef _IPI_HANDLER_H
 #define _IPI_HANDLER_H
 
-void handle_ipi_mail();
+void platform_register_ipi_handlers();
 
 #endif /* _IPI_HANDLER_H */
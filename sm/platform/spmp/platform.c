@@ -11,6 +11,9 @@ int platform_init()
   //hart will execute this function.
   clear_pmp(0);
 
+  //handlers must be in place before this hart syncs pmp with others
+  platform_register_ipi_handlers();
+
   //config the last PMP to allow kernel to access memory
   struct pmp_config_t pmp_config;
   pmp_config.paddr = 0;
@@ -36,3 +39,9 @@ int platform_init()
 
   return 0;
 }
+
+//fill buf from a hardware TRNG, return -1 if the platform has none
+int platform_get_entropy(void* buf, unsigned long size)
+{
+  return -1;
+}
@@ -8,4 +8,6 @@
 
 int platform_init();
 
+int platform_get_entropy(void* buf, unsigned long size);
+
 #endif /* _PLATFORM_H */
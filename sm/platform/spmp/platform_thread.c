@@ -18,7 +18,8 @@ int platform_check_in_enclave_world()
 
 int platform_check_enclave_authentication(struct enclave_t* enclave)
 {
-  if(enclave->thread_context.encl_ptbr != read_csr(satp))
+  //all threads of an enclave share the same page table
+  if(enclave->threads[0].context.encl_ptbr != read_csr(satp))
     return -1;
   return 0;
 }
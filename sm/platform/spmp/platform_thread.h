@@ -9,7 +9,9 @@ void platform_exit_enclave_world();
 
 int platform_check_in_enclave_world();
 
-int platform_check_enclave_authentication();
+struct enclave_t;
+
+int platform_check_enclave_authentication(struct enclave_t* enclave);
 
 void platform_switch_to_enclave_ptbr(struct thread_state_t* thread, uintptr_t ptbr);
 
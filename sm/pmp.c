@@ -2,26 +2,81 @@
 #include "ipi.h"
 #include <stddef.h>
 
+/*
+ * Updates of the same pmp entry are serialized from the local set to the
+ * last ack, so that every hart applies them in the same order.
+ */
+static spinlock_t pmp_idx_lock[NPMP];
+
+static void lock_pmp_idx(int pmp_idx)
+{
+  uintptr_t incoming_ipi = 0;
+
+  //the holder may be waiting for current hart to handle its mail
+  while(spinlock_trylock(&pmp_idx_lock[pmp_idx]))
+    ipi_wait_poll(&incoming_ipi);
+  ipi_wait_done(incoming_ipi);
+}
+
+static void unlock_pmp_idx(int pmp_idx)
+{
+  spinlock_unlock(&pmp_idx_lock[pmp_idx]);
+}
+
 //set pmp and sync all harts
 void set_pmp_and_sync(int pmp_idx_arg, struct pmp_config_t pmp_config_arg)
 {
-  struct pmp_config_t* pmp_config = NULL;
-  int* pmp_idx = NULL;
+  struct pmp_sync_t pmp_sync;
 
-  spinlock_lock(&ipi_mail_lock);
+  lock_pmp_idx(pmp_idx_arg);
 
   //set current hart's pmp
   set_pmp(pmp_idx_arg, pmp_config_arg);
   //sync all other harts
-  ipi_mail.event = IPI_PMP_SYNC;
-  pmp_config = (void*)ipi_mail.data;
-  pmp_idx = (void*)ipi_mail.data + sizeof(struct pmp_config_t);
-  *pmp_config = pmp_config_arg;
-  *pmp_idx = pmp_idx_arg;
+  pmp_sync.pmp_config = pmp_config_arg;
+  pmp_sync.pmp_idx = pmp_idx_arg;
+
+  send_ipi_rpc(NULL, IPI_PMP_SYNC, &pmp_sync, IPI_WAIT_ALL);
+
+  unlock_pmp_idx(pmp_idx_arg);
+
+  return;
+}
 
-  send_and_sync_ipi_mail(0xFFFFFFFF);
+/*
+ * Move pmp_idx to the NAPOT range [paddr, paddr + size) on all harts.
+ * Every hart keeps the permission its local src_idx entry holds, so a
+ * hart running an enclave in the range does not lose access to it.
+ */
+void resize_pmp_and_sync(int pmp_idx, int src_idx, uintptr_t paddr, unsigned long size)
+{
+  struct pmp_resize_t pmp_resize;
+
+  pmp_resize.paddr = paddr;
+  pmp_resize.size = size;
+  pmp_resize.pmp_idx = pmp_idx;
+  pmp_resize.src_idx = src_idx;
+
+  lock_pmp_idx(pmp_idx);
+
+  //set current hart's pmp
+  resize_pmp(pmp_resize);
+  //sync all other harts
+  send_ipi_rpc(NULL, IPI_PMP_RESIZE, &pmp_resize, IPI_WAIT_ALL);
+
+  unlock_pmp_idx(pmp_idx);
+
+  return;
+}
+
+void resize_pmp(struct pmp_resize_t pmp_resize)
+{
+  struct pmp_config_t pmp_config = get_pmp(pmp_resize.src_idx);
 
-  spinlock_unlock(&ipi_mail_lock);
+  pmp_config.paddr = pmp_resize.paddr;
+  pmp_config.size = pmp_resize.size;
+  pmp_config.mode = PMP_NAPOT;
+  set_pmp(pmp_resize.pmp_idx, pmp_config);
 
   return;
 }
@@ -119,7 +174,7 @@ struct pmp_config_t get_pmp(int pmp_idx)
         pmp_address >>= 1;
       }
       order += 3;
-      size = 1 << order;
+      size = 1UL << order;
       pmp_address <<= (order-1);
       break;
     case PMP_NA4:
@@ -62,8 +62,28 @@ struct pmp_config_t
   uintptr_t mode;
 };
 
+//payload of IPI_PMP_SYNC
+struct pmp_sync_t
+{
+  struct pmp_config_t pmp_config;
+  int pmp_idx;
+};
+
+//payload of IPI_PMP_RESIZE
+struct pmp_resize_t
+{
+  uintptr_t paddr;
+  unsigned long size;
+  int pmp_idx;
+  int src_idx;
+};
+
 void set_pmp_and_sync(int pmp_idx, struct pmp_config_t);
 
+void resize_pmp_and_sync(int pmp_idx, int src_idx, uintptr_t paddr, unsigned long size);
+
+void resize_pmp(struct pmp_resize_t);
+
 void clear_pmp_and_sync(int pmp_idx);
 
 void set_pmp(int pmp_idx, struct pmp_config_t);
@@ -0,0 +1,133 @@
+#include "relay_page.h"
+#include "sm.h"
+#include "atomic.h"
+#include <string.h>
+
+static struct relay_page_t relay_page = {0,};
+static spinlock_t relay_page_lock = SPINLOCK_INIT;
+
+int relay_page_alloc(unsigned long req_size, unsigned long host_ptbr, uintptr_t* paddr, unsigned long* size)
+{
+  unsigned long resp_size = 0;
+  void* addr;
+  int retval = 0;
+
+  spinlock_lock(&relay_page_lock);
+
+  if(relay_page.valid)
+  {
+    printm("M mode: relay_page_alloc: relay page is in use\r\n");
+    retval = -1;
+    goto relay_page_alloc_out;
+  }
+
+  addr = mm_alloc(req_size, &resp_size);
+  if(!addr)
+  {
+    printm("M mode: relay_page_alloc: no enough memory\r\n");
+    retval = -1;
+    goto relay_page_alloc_out;
+  }
+
+  if(grant_relay_access(addr, resp_size) < 0)
+  {
+    mm_free(addr, resp_size);
+    retval = -1;
+    goto relay_page_alloc_out;
+  }
+
+  relay_page.valid = 1;
+  relay_page.paddr = (uintptr_t)addr;
+  relay_page.size = resp_size;
+  relay_page.host_ptbr = host_ptbr;
+  relay_page.owner = RELAY_OWNER_HOST;
+  *paddr = relay_page.paddr;
+  *size = relay_page.size;
+
+relay_page_alloc_out:
+  spinlock_unlock(&relay_page_lock);
+  return retval;
+}
+
+int relay_page_to_enclave(uintptr_t paddr, unsigned long host_ptbr, int eid, unsigned long* size)
+{
+  int retval = 0;
+
+  spinlock_lock(&relay_page_lock);
+
+  if(!relay_page.valid || relay_page.paddr != paddr || relay_page.host_ptbr != host_ptbr
+      || relay_page.owner != RELAY_OWNER_HOST)
+  {
+    printm("M mode: relay_page_to_enclave: relay page 0x%lx is not owned by host\r\n", paddr);
+    retval = -1;
+    goto relay_page_to_enclave_out;
+  }
+
+  //host loses its access on every hart before the enclave gets it
+  if(retrieve_relay_access((void*)relay_page.paddr, relay_page.size) < 0)
+  {
+    retval = -1;
+    goto relay_page_to_enclave_out;
+  }
+
+  relay_page.owner = eid;
+  *size = relay_page.size;
+
+relay_page_to_enclave_out:
+  spinlock_unlock(&relay_page_lock);
+  return retval;
+}
+
+int relay_page_to_host(uintptr_t paddr, int eid)
+{
+  int retval = 0;
+
+  spinlock_lock(&relay_page_lock);
+
+  if(!relay_page.valid || relay_page.paddr != paddr || relay_page.owner != eid)
+  {
+    printm("M mode: relay_page_to_host: relay page 0x%lx is not owned by enclave%d\r\n", paddr, eid);
+    retval = -1;
+    goto relay_page_to_host_out;
+  }
+
+  if(grant_relay_access((void*)relay_page.paddr, relay_page.size) < 0)
+  {
+    retval = -1;
+    goto relay_page_to_host_out;
+  }
+
+  relay_page.owner = RELAY_OWNER_HOST;
+
+relay_page_to_host_out:
+  spinlock_unlock(&relay_page_lock);
+  return retval;
+}
+
+int relay_page_free(uintptr_t paddr, unsigned long host_ptbr)
+{
+  int retval = 0;
+
+  spinlock_lock(&relay_page_lock);
+
+  if(!relay_page.valid || relay_page.paddr != paddr || relay_page.host_ptbr != host_ptbr
+      || relay_page.owner != RELAY_OWNER_HOST)
+  {
+    printm("M mode: relay_page_free: relay page 0x%lx is not owned by host\r\n", paddr);
+    retval = -1;
+    goto relay_page_free_out;
+  }
+
+  if(retrieve_relay_access((void*)relay_page.paddr, relay_page.size) < 0)
+  {
+    retval = -1;
+    goto relay_page_free_out;
+  }
+
+  mm_free((void*)relay_page.paddr, relay_page.size);
+  memset(&relay_page, 0, sizeof(struct relay_page_t));
+
+relay_page_free_out:
+  spinlock_unlock(&relay_page_lock);
+  return retval;
+}
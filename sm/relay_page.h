@@ -0,0 +1,33 @@
+#ifndef _RELAY_PAGE_H
+#define _RELAY_PAGE_H
+
+#include <stdint.h>
+
+//owner of a relay page which is not owned by any enclave
+#define RELAY_OWNER_HOST  -1
+
+/*
+ * Relay page: a block allocated from the enclave memory pool whose
+ * ownership moves between the host and an enclave without copying.
+ * Only one side can touch it at a time, host access is controlled by
+ * RELAY_PMP_IDX and enclave access by RELAY_SPMP_IDX.
+ * As one PMP is reserved for it, only one relay page exists at a time.
+ */
+struct relay_page_t
+{
+  int valid;
+  uintptr_t paddr;
+  unsigned long size;
+  unsigned long host_ptbr;
+  int owner;
+};
+
+int relay_page_alloc(unsigned long req_size, unsigned long host_ptbr, uintptr_t* paddr, unsigned long* size);
+
+int relay_page_to_enclave(uintptr_t paddr, unsigned long host_ptbr, int eid, unsigned long* size);
+
+int relay_page_to_host(uintptr_t paddr, int eid);
+
+int relay_page_free(uintptr_t paddr, unsigned long host_ptbr);
+
+#endif /* _RELAY_PAGE_H */
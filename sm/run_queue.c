@@ -0,0 +1,100 @@
+#include "run_queue.h"
+#include "mtrap.h"
+#include "atomic.h"
+
+static struct run_queue_t run_queues[MAX_HARTS];
+static spinlock_t run_queue_locks[MAX_HARTS];
+
+int run_queue_push(int hart, int eid, int tid)
+{
+  struct run_queue_t* queue = &run_queues[hart];
+  int retval = 0;
+
+  spinlock_lock(&run_queue_locks[hart]);
+
+  if(queue->tail - queue->head >= RUN_QUEUE_SIZE)
+  {
+    retval = -1;
+    goto run_queue_push_out;
+  }
+
+  queue->entries[queue->tail % RUN_QUEUE_SIZE].eid = eid;
+  queue->entries[queue->tail % RUN_QUEUE_SIZE].tid = tid;
+  queue->tail++;
+
+run_queue_push_out:
+  spinlock_unlock(&run_queue_locks[hart]);
+  return retval;
+}
+
+int run_queue_full(int hart)
+{
+  struct run_queue_t* queue = &run_queues[hart];
+  int full;
+
+  spinlock_lock(&run_queue_locks[hart]);
+  full = (queue->tail - queue->head >= RUN_QUEUE_SIZE);
+  spinlock_unlock(&run_queue_locks[hart]);
+
+  return full;
+}
+
+/*
+ * Take the first entry accepted by filter out of the queue of hart.
+ * Entries dropped by filter are removed, skipped ones keep their order.
+ */
+int run_queue_pop(int hart, run_queue_filter_t filter, void* arg, int* eid, int* tid)
+{
+  struct run_queue_t* queue = &run_queues[hart];
+  struct run_queue_entry_t entry;
+  unsigned long i, j;
+  int found = -1;
+
+  spinlock_lock(&run_queue_locks[hart]);
+
+  i = queue->head;
+  while(i != queue->tail)
+  {
+    entry = queue->entries[i % RUN_QUEUE_SIZE];
+    switch(filter(hart, entry.eid, entry.tid, arg))
+    {
+      case RUN_QUEUE_SKIP:
+        i++;
+        continue;
+      case RUN_QUEUE_TAKE:
+        *eid = entry.eid;
+        *tid = entry.tid;
+        found = 0;
+        break;
+      default:
+        break;
+    }
+
+    //remove entry i and close the gap
+    for(j = i; j + 1 != queue->tail; ++j)
+      queue->entries[j % RUN_QUEUE_SIZE] = queue->entries[(j + 1) % RUN_QUEUE_SIZE];
+    queue->tail--;
+
+    if(found == 0)
+      break;
+  }
+
+  spinlock_unlock(&run_queue_locks[hart]);
+  return found;
+}
+
+//an idle hart takes work from the queue of another hart
+int run_queue_steal(int hart, run_queue_filter_t filter, void* arg, int* eid, int* tid)
+{
+  int i;
+
+  for(i = 0; i < MAX_HARTS; ++i)
+  {
+    if(i == hart)
+      continue;
+    if(run_queue_pop(i, filter, arg, eid, tid) == 0)
+      return 0;
+  }
+
+  return -1;
+}
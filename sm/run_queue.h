@@ -0,0 +1,41 @@
+#ifndef _RUN_QUEUE_H
+#define _RUN_QUEUE_H
+
+#include <stdint.h>
+
+#define RUN_QUEUE_SIZE 64
+
+//return value of a run queue filter
+#define RUN_QUEUE_TAKE  0
+#define RUN_QUEUE_SKIP  1
+#define RUN_QUEUE_DROP  2
+
+struct run_queue_entry_t
+{
+  int eid;
+  int tid;
+};
+
+/*
+ * Per-hart FIFO of runnable enclave threads scheduled by the security
+ * monitor. Entries are removed lazily: the filter given to
+ * run_queue_pop() drops entries which are no longer queued.
+ */
+struct run_queue_t
+{
+  unsigned long head;
+  unsigned long tail;
+  struct run_queue_entry_t entries[RUN_QUEUE_SIZE];
+};
+
+typedef int (*run_queue_filter_t)(int hart, int eid, int tid, void* arg);
+
+int run_queue_push(int hart, int eid, int tid);
+
+int run_queue_full(int hart);
+
+int run_queue_pop(int hart, run_queue_filter_t filter, void* arg, int* eid, int* tid);
+
+int run_queue_steal(int hart, run_queue_filter_t filter, void* arg, int* eid, int* tid);
+
+#endif /* _RUN_QUEUE_H */
@@ -0,0 +1,231 @@
+#include "shm.h"
+#include "sm.h"
+#include "atomic.h"
+#include <string.h>
+
+static struct shm_t shms[SHM_MAX_OBJECTS];
+static spinlock_t shm_lock = SPINLOCK_INIT;
+
+static struct shm_t* get_shm(int shm_id)
+{
+  if(shm_id < 0 || shm_id >= SHM_MAX_OBJECTS || !shms[shm_id].valid)
+    return NULL;
+
+  return &shms[shm_id];
+}
+
+static struct shm_grant_t* get_shm_grant(struct shm_t* shm, int eid)
+{
+  int i;
+
+  for(i = 0; i < SHM_MAX_GRANTS; ++i)
+  {
+    if(shm->grants[i].perm && shm->grants[i].eid == eid)
+      return &shm->grants[i];
+  }
+
+  return NULL;
+}
+
+int shm_create(unsigned long size, unsigned long host_ptbr)
+{
+  unsigned long resp_size = 0;
+  int shm_id;
+  void* paddr;
+
+  spinlock_lock(&shm_lock);
+
+  for(shm_id = 0; shm_id < SHM_MAX_OBJECTS; ++shm_id)
+  {
+    if(!shms[shm_id].valid)
+      break;
+  }
+  if(shm_id >= SHM_MAX_OBJECTS)
+  {
+    printm("M mode: shm_create: no free shm object\r\n");
+    shm_id = -1;
+    goto shm_create_out;
+  }
+
+  //mm_alloc zeroes the memory if resp_size is given
+  paddr = mm_alloc(size, &resp_size);
+  if(!paddr)
+  {
+    printm("M mode: shm_create: no enough memory\r\n");
+    shm_id = -1;
+    goto shm_create_out;
+  }
+
+  memset(&shms[shm_id], 0, sizeof(struct shm_t));
+  shms[shm_id].valid = 1;
+  shms[shm_id].paddr = (uintptr_t)paddr;
+  shms[shm_id].size = resp_size;
+  shms[shm_id].host_ptbr = host_ptbr;
+
+shm_create_out:
+  spinlock_unlock(&shm_lock);
+  return shm_id;
+}
+
+int shm_grant(int shm_id, int eid, unsigned long perm, unsigned long host_ptbr)
+{
+  struct shm_t* shm;
+  struct shm_grant_t* grant;
+  int retval = 0, i;
+
+  perm &= SHM_PERM_R | SHM_PERM_W;
+  if(!perm)
+    return -1;
+
+  spinlock_lock(&shm_lock);
+
+  shm = get_shm(shm_id);
+  if(!shm || shm->host_ptbr != host_ptbr)
+  {
+    printm("M mode: shm_grant: wrong shm id%d\r\n", shm_id);
+    retval = -1;
+    goto shm_grant_out;
+  }
+
+  grant = get_shm_grant(shm, eid);
+  if(grant)
+  {
+    if(grant->attached)
+    {
+      printm("M mode: shm_grant: shm%d is attached by enclave%d\r\n", shm_id, eid);
+      retval = -1;
+      goto shm_grant_out;
+    }
+    grant->perm = perm;
+    goto shm_grant_out;
+  }
+
+  for(i = 0; i < SHM_MAX_GRANTS; ++i)
+  {
+    if(!shm->grants[i].perm)
+    {
+      shm->grants[i].eid = eid;
+      shm->grants[i].perm = perm;
+      shm->grants[i].attached = 0;
+      break;
+    }
+  }
+  if(i >= SHM_MAX_GRANTS)
+  {
+    printm("M mode: shm_grant: too many enclaves share shm%d\r\n", shm_id);
+    retval = -1;
+  }
+
+shm_grant_out:
+  spinlock_unlock(&shm_lock);
+  return retval;
+}
+
+/*
+ * Mark shm as attached by enclave eid at va and return the shm
+ * object together with the permission granted to the enclave.
+ */
+int shm_attach(int shm_id, int eid, unsigned long va, struct shm_t* shm_out, unsigned long* perm)
+{
+  struct shm_t* shm;
+  struct shm_grant_t* grant;
+  int retval = 0;
+
+  spinlock_lock(&shm_lock);
+
+  shm = get_shm(shm_id);
+  grant = shm ? get_shm_grant(shm, eid) : NULL;
+  if(!grant || grant->attached)
+  {
+    printm("M mode: shm_attach: enclave%d can not attach shm%d\r\n", eid, shm_id);
+    retval = -1;
+    goto shm_attach_out;
+  }
+
+  grant->attached = 1;
+  grant->va = va;
+  *shm_out = *shm;
+  *perm = grant->perm;
+
+shm_attach_out:
+  spinlock_unlock(&shm_lock);
+  return retval;
+}
+
+int shm_detach(int shm_id, int eid)
+{
+  struct shm_t* shm;
+  struct shm_grant_t* grant;
+  int retval = 0;
+
+  spinlock_lock(&shm_lock);
+
+  shm = get_shm(shm_id);
+  grant = shm ? get_shm_grant(shm, eid) : NULL;
+  if(!grant || !grant->attached)
+  {
+    retval = -1;
+    goto shm_detach_out;
+  }
+
+  grant->attached = 0;
+  grant->va = 0;
+
+shm_detach_out:
+  spinlock_unlock(&shm_lock);
+  return retval;
+}
+
+int shm_destroy(int shm_id, unsigned long host_ptbr)
+{
+  struct shm_t* shm;
+  int retval = 0, i;
+
+  spinlock_lock(&shm_lock);
+
+  shm = get_shm(shm_id);
+  if(!shm || shm->host_ptbr != host_ptbr)
+  {
+    printm("M mode: shm_destroy: wrong shm id%d\r\n", shm_id);
+    retval = -1;
+    goto shm_destroy_out;
+  }
+
+  for(i = 0; i < SHM_MAX_GRANTS; ++i)
+  {
+    if(shm->grants[i].perm && shm->grants[i].attached)
+    {
+      printm("M mode: shm_destroy: shm%d is still attached by enclave%d\r\n", shm_id, shm->grants[i].eid);
+      retval = -1;
+      goto shm_destroy_out;
+    }
+  }
+
+  memset((void*)shm->paddr, 0, shm->size);
+  mm_free((void*)shm->paddr, shm->size);
+  shm->valid = 0;
+
+shm_destroy_out:
+  spinlock_unlock(&shm_lock);
+  return retval;
+}
+
+//drop every grant held by a destroyed enclave
+void shm_release_enclave(int eid)
+{
+  struct shm_grant_t* grant;
+  int shm_id;
+
+  spinlock_lock(&shm_lock);
+
+  for(shm_id = 0; shm_id < SHM_MAX_OBJECTS; ++shm_id)
+  {
+    if(!shms[shm_id].valid)
+      continue;
+    grant = get_shm_grant(&shms[shm_id], eid);
+    if(grant)
+      memset(grant, 0, sizeof(struct shm_grant_t));
+  }
+
+  spinlock_unlock(&shm_lock);
+}
@@ -0,0 +1,46 @@
+#ifndef _SHM_H
+#define _SHM_H
+
+#include <stdint.h>
+
+#define SHM_MAX_OBJECTS 16
+#define SHM_MAX_GRANTS  8
+
+//permission of a shared memory object granted to an enclave
+#define SHM_PERM_R      0x1
+#define SHM_PERM_W      0x2
+
+struct shm_grant_t
+{
+  int eid;
+  unsigned long perm;
+  unsigned long va;
+  int attached;
+};
+
+/*
+ * shared memory object allocated from the enclave memory pool
+ * and shared by a set of enclaves, host has no access to it
+ */
+struct shm_t
+{
+  int valid;
+  uintptr_t paddr;
+  unsigned long size;
+  unsigned long host_ptbr;
+  struct shm_grant_t grants[SHM_MAX_GRANTS];
+};
+
+int shm_create(unsigned long size, unsigned long host_ptbr);
+
+int shm_grant(int shm_id, int eid, unsigned long perm, unsigned long host_ptbr);
+
+int shm_attach(int shm_id, int eid, unsigned long va, struct shm_t* shm, unsigned long* perm);
+
+int shm_detach(int shm_id, int eid);
+
+int shm_destroy(int shm_id, unsigned long host_ptbr);
+
+void shm_release_enclave(int eid);
+
+#endif /* _SHM_H */
@@ -2,6 +2,8 @@
 #include "sm.h"
 #include "pmp.h"
 #include "enclave.h"
+#include "shm.h"
+#include "relay_page.h"
 #include "math.h"
 
 static int sm_initialized = 0;
@@ -30,6 +32,34 @@ uintptr_t sm_mm_extend(uintptr_t paddr, unsigned long size)
   return retval;
 }
 
+uintptr_t sm_memory_reclaim(uintptr_t mm_reclaim_arg)
+{
+  struct mm_alloc_arg_t mm_reclaim_arg_local;
+  uintptr_t paddr = 0;
+  unsigned long size = 0;
+
+  //req_size is the smallest block worth reclaiming
+  if(copy_from_host(&mm_reclaim_arg_local,
+      (struct mm_alloc_arg_t*)mm_reclaim_arg,
+      sizeof(struct mm_alloc_arg_t)) != 0)
+  {
+    printm("M mode: sm_memory_reclaim: unknown error happended when copy from host\r\n");
+    return ENCLAVE_ERROR;
+  }
+
+  if(mm_reclaim(mm_reclaim_arg_local.req_size, &paddr, &size) < 0)
+    return ENCLAVE_NO_MEMORY;
+
+  mm_reclaim_arg_local.resp_addr = paddr;
+  mm_reclaim_arg_local.resp_size = size;
+
+  copy_to_host((struct mm_alloc_arg_t*)mm_reclaim_arg,
+      &mm_reclaim_arg_local,
+      sizeof(struct mm_alloc_arg_t));
+
+  return ENCLAVE_SUCCESS;
+}
+
 //TODO: delete this function
 uintptr_t sm_debug_print(uintptr_t* regs, uintptr_t arg0)
 {
@@ -96,15 +126,29 @@ uintptr_t sm_create_enclave(uintptr_t enclave_sbi_param)
 
   //TODO: not finished yet
   retval = create_enclave(enclave_sbi_param_local);
+  if(retval != 0)
+  {
+    memset(paddr, 0, size);
+    mm_free(paddr, size);
+  }
+
+  return retval;
+}
+
+uintptr_t sm_run_enclave(uintptr_t* regs, unsigned long eid, unsigned long tid)
+{
+  uintptr_t retval;
+
+  retval = run_enclave(regs, (unsigned int)eid, (unsigned int)tid);
 
   return retval;
 }
 
-uintptr_t sm_run_enclave(uintptr_t* regs, unsigned long eid)
+uintptr_t sm_run_enclave_exclusive(uintptr_t* regs, unsigned long eid, unsigned long tid)
 {
   uintptr_t retval;
 
-  retval = run_enclave(regs, (unsigned int)eid);
+  retval = run_enclave_exclusive(regs, (unsigned int)eid, (unsigned int)tid);
 
   return retval;
 }
@@ -136,6 +180,9 @@ uintptr_t sm_resume_enclave(uintptr_t* regs, unsigned long eid)
       //printm("resume from stop\r\n");
       retval = resume_from_stop(regs, eid);
       break;
+    case RESUME_FROM_OCALL:
+      retval = resume_from_ocall(regs, eid);
+      break;
     default:
       break;
   }
@@ -143,6 +190,15 @@ uintptr_t sm_resume_enclave(uintptr_t* regs, unsigned long eid)
   return retval;
 }
 
+uintptr_t sm_enclave_ocall(uintptr_t* regs, uintptr_t ocall_func_id, uintptr_t arg0, uintptr_t arg1)
+{
+  uintptr_t ret;
+
+  ret = enclave_ocall(regs, ocall_func_id, arg0, arg1);
+
+  return ret;
+}
+
 uintptr_t sm_exit_enclave(uintptr_t* regs, unsigned long retval)
 {
   uintptr_t ret;
@@ -152,6 +208,191 @@ uintptr_t sm_exit_enclave(uintptr_t* regs, unsigned long retval)
   return ret;
 }
 
+uintptr_t sm_call_enclave(uintptr_t* regs, unsigned long eid, uintptr_t arg0, uintptr_t arg1)
+{
+  uintptr_t retval;
+
+  retval = call_enclave(regs, (unsigned int)eid, arg0, arg1);
+
+  return retval;
+}
+
+uintptr_t sm_enclave_return(uintptr_t* regs, unsigned long retval)
+{
+  uintptr_t ret;
+
+  ret = enclave_return(regs, retval);
+
+  return ret;
+}
+
+uintptr_t sm_create_shm(uintptr_t size)
+{
+  int shm_id;
+
+  shm_id = shm_create(size, read_csr(satp));
+
+  return (uintptr_t)(long)shm_id;
+}
+
+uintptr_t sm_grant_shm(uintptr_t shm_id, unsigned long eid, uintptr_t perm)
+{
+  struct enclave_t* enclave = get_enclave((int)eid);
+
+  if(!enclave || enclave->state == INVALID || enclave->host_ptbr != read_csr(satp))
+  {
+    printm("M mode: sm_grant_shm: enclave doesn't belong to current host process\r\n");
+    return -1UL;
+  }
+
+  if(shm_grant((int)shm_id, (int)eid, perm, read_csr(satp)) < 0)
+    return -1UL;
+
+  return 0;
+}
+
+uintptr_t sm_attach_shm(uintptr_t* regs, uintptr_t shm_id, uintptr_t va)
+{
+  uintptr_t retval;
+
+  retval = attach_shm(regs, (int)shm_id, va);
+
+  return retval;
+}
+
+uintptr_t sm_detach_shm(uintptr_t* regs)
+{
+  uintptr_t retval;
+
+  retval = detach_shm(regs);
+
+  return retval;
+}
+
+uintptr_t sm_destroy_shm(uintptr_t shm_id)
+{
+  if(shm_destroy((int)shm_id, read_csr(satp)) < 0)
+    return -1UL;
+
+  return 0;
+}
+
+uintptr_t sm_alloc_relay_page(uintptr_t mm_alloc_arg)
+{
+  struct mm_alloc_arg_t mm_alloc_arg_local;
+  uintptr_t paddr = 0;
+  unsigned long size = 0;
+
+  if(copy_from_host(&mm_alloc_arg_local,
+      (struct mm_alloc_arg_t*)mm_alloc_arg,
+      sizeof(struct mm_alloc_arg_t)) != 0)
+  {
+    printm("M mode: sm_alloc_relay_page: unknown error happended when copy from host\r\n");
+    return ENCLAVE_ERROR;
+  }
+
+  if(relay_page_alloc(mm_alloc_arg_local.req_size, read_csr(satp), &paddr, &size) < 0)
+    return ENCLAVE_NO_MEMORY;
+
+  mm_alloc_arg_local.resp_addr = paddr;
+  mm_alloc_arg_local.resp_size = size;
+
+  copy_to_host((struct mm_alloc_arg_t*)mm_alloc_arg,
+      &mm_alloc_arg_local,
+      sizeof(struct mm_alloc_arg_t));
+
+  return ENCLAVE_SUCCESS;
+}
+
+uintptr_t sm_transfer_relay_page(uintptr_t eid, uintptr_t paddr, uintptr_t va)
+{
+  uintptr_t retval;
+
+  retval = transfer_relay_page((unsigned int)eid, paddr, va);
+
+  return retval;
+}
+
+uintptr_t sm_return_relay_page(uintptr_t* regs)
+{
+  uintptr_t retval;
+
+  retval = return_relay_page(regs);
+
+  return retval;
+}
+
+uintptr_t sm_free_relay_page(uintptr_t paddr)
+{
+  if(relay_page_free(paddr, read_csr(satp)) < 0)
+    return -1UL;
+
+  return 0;
+}
+
+uintptr_t sm_migrate_enclave(uintptr_t eid, uintptr_t tid, uintptr_t dest_hart)
+{
+  uintptr_t retval;
+
+  retval = migrate_enclave((unsigned int)eid, (int)tid, (int)dest_hart);
+
+  return retval;
+}
+
+uintptr_t sm_set_enclave_slice(uintptr_t eid, uintptr_t time_slice)
+{
+  uintptr_t retval;
+
+  retval = set_enclave_time_slice((unsigned int)eid, time_slice);
+
+  return retval;
+}
+
+uintptr_t sm_memory_compact(uintptr_t budget)
+{
+  uintptr_t retval;
+
+  retval = compact_enclave_memory(budget);
+
+  return retval;
+}
+
+int sm_enclave_page_fault(uintptr_t* regs, uintptr_t mcause, uintptr_t badaddr)
+{
+  int retval;
+
+  retval = enclave_page_fault(regs, mcause, badaddr);
+
+  return retval;
+}
+
+uintptr_t sm_evict_enclave_pages(uintptr_t eid, uintptr_t swap_arg)
+{
+  uintptr_t retval;
+
+  retval = evict_enclave_pages((unsigned int)eid, (struct swap_arg_t*)swap_arg);
+
+  return retval;
+}
+
+uintptr_t sm_yield_enclave(uintptr_t* regs, uintptr_t wake_hint)
+{
+  uintptr_t retval;
+
+  retval = yield_enclave(regs, wake_hint);
+
+  return retval;
+}
+
+uintptr_t sm_enclave_set_timer(uint64_t deadline)
+{
+  uintptr_t retval;
+
+  retval = enclave_set_timer(deadline);
+
+  return retval;
+}
+
 uintptr_t sm_do_timer_irq(uintptr_t *regs, uintptr_t mcause, uintptr_t mepc)
 {
   uintptr_t ret;
@@ -9,6 +9,8 @@
 #include <stdint.h>
 #include "enclave_args.h"
 #include "ipi.h"
+#include "ocall.h"
+#include "doorbell.h"
 
 #define SM_BASE 0x80000000
 #define SM_SIZE 0x200000
@@ -27,30 +29,59 @@
 #define SBI_ENCLAVE_OCALL       90
 #define SBI_EXIT_ENCLAVE        89
 #define SBI_DEBUG_PRINT         88
+#define SBI_CALL_ENCLAVE        87
+#define SBI_ENCLAVE_RETURN      86
+#define SBI_CREATE_SHM          85
+#define SBI_GRANT_SHM           84
+#define SBI_ATTACH_SHM          83
+#define SBI_DETACH_SHM          82
+#define SBI_DESTROY_SHM         81
+#define SBI_ALLOC_RELAY_PAGE    80
+#define SBI_TRANSFER_RELAY_PAGE 79
+#define SBI_RETURN_RELAY_PAGE   78
+#define SBI_FREE_RELAY_PAGE     77
+#define SBI_RUN_ENCLAVE_EXCLUSIVE 76
+#define SBI_SET_ENCLAVE_SLICE   75
+#define SBI_MIGRATE_ENCLAVE     74
+#define SBI_YIELD_ENCLAVE       73
+#define SBI_MEMORY_COMPACT      72
+#define SBI_EVICT_ENCLAVE_PAGES 71
+
+//the calls above as FIDs of an SBI vendor extension, they return a0 only
+#define SBI_EXT_PENGLAI      0x09504E47
 
 //Error code of SBI_ALLOC_ENCLAVE_MEM
 #define ENCLAVE_NO_MEMORY       -2
 #define ENCLAVE_ERROR           -1
 #define ENCLAVE_SUCCESS          0
 #define ENCLAVE_TIMER_IRQ        1
+#define ENCLAVE_OCALL            2
+#define ENCLAVE_YIELD            3
 
 //error code of SBI_RESUME_RNCLAVE
 #define RESUME_FROM_TIMER_IRQ    2000
+#define RESUME_FROM_OCALL        2001
 #define RESUME_FROM_STOP         2003
 
 void sm_init();
 
+void sm_sbi_init();
+
 uintptr_t sm_mm_init(uintptr_t paddr, unsigned long size);
 
 uintptr_t sm_mm_extend(uintptr_t paddr, unsigned long size);
 
 uintptr_t sm_alloc_enclave_mem(uintptr_t mm_alloc_arg);
 
+uintptr_t sm_memory_reclaim(uintptr_t mm_reclaim_arg);
+
 uintptr_t sm_create_enclave(uintptr_t enclave_create_args);
 
 uintptr_t sm_attest_enclave(uintptr_t enclave_id, uintptr_t report, uintptr_t nonce);
 
-uintptr_t sm_run_enclave(uintptr_t *regs, uintptr_t enclave_id);
+uintptr_t sm_run_enclave(uintptr_t *regs, uintptr_t enclave_id, uintptr_t tid);
+
+uintptr_t sm_run_enclave_exclusive(uintptr_t *regs, uintptr_t enclave_id, uintptr_t tid);
 
 uintptr_t sm_debug_print(uintptr_t *regs, uintptr_t enclave_id);
 
@@ -60,12 +91,50 @@ uintptr_t sm_resume_enclave(uintptr_t *regs, uintptr_t enclave_id);
 
 uintptr_t sm_destroy_enclave(uintptr_t *regs, uintptr_t enclave_id, uintptr_t destroy_flag);
 
-uintptr_t sm_enclave_ocall(uintptr_t *regs, uintptr_t ocall_func_id, uintptr_t arg);
+uintptr_t sm_enclave_ocall(uintptr_t *regs, uintptr_t ocall_func_id, uintptr_t arg0, uintptr_t arg1);
 
 uintptr_t sm_exit_enclave(uintptr_t *regs, unsigned long retval);
 
+uintptr_t sm_call_enclave(uintptr_t *regs, uintptr_t enclave_id, uintptr_t arg0, uintptr_t arg1);
+
+uintptr_t sm_enclave_return(uintptr_t *regs, uintptr_t retval);
+
+uintptr_t sm_create_shm(uintptr_t size);
+
+uintptr_t sm_grant_shm(uintptr_t shm_id, uintptr_t enclave_id, uintptr_t perm);
+
+uintptr_t sm_attach_shm(uintptr_t *regs, uintptr_t shm_id, uintptr_t va);
+
+uintptr_t sm_detach_shm(uintptr_t *regs);
+
+uintptr_t sm_destroy_shm(uintptr_t shm_id);
+
+uintptr_t sm_alloc_relay_page(uintptr_t mm_alloc_arg);
+
+uintptr_t sm_transfer_relay_page(uintptr_t enclave_id, uintptr_t paddr, uintptr_t va);
+
+uintptr_t sm_return_relay_page(uintptr_t *regs);
+
+uintptr_t sm_free_relay_page(uintptr_t paddr);
+
+uintptr_t sm_migrate_enclave(uintptr_t enclave_id, uintptr_t tid, uintptr_t dest_hart);
+
+uintptr_t sm_set_enclave_slice(uintptr_t enclave_id, uintptr_t time_slice);
+
+uintptr_t sm_yield_enclave(uintptr_t *regs, uintptr_t wake_hint);
+
+uintptr_t sm_memory_compact(uintptr_t budget);
+
+int sm_enclave_page_fault(uintptr_t *regs, uintptr_t mcause, uintptr_t badaddr);
+
+uintptr_t sm_evict_enclave_pages(uintptr_t enclave_id, uintptr_t swap_arg);
+
+uintptr_t sm_enclave_set_timer(uint64_t deadline);
+
 uintptr_t sm_do_timer_irq(uintptr_t *regs, uintptr_t mcause, uintptr_t mepc);
 
 int check_in_enclave_world();
 
+void get_exclusive_hart_mask(hartmask_t* mask);
+
 #endif /* _SM_H */
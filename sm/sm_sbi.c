@@ -0,0 +1,100 @@
+#include "sm.h"
+#include "mtrap.h"
+#include "sbi_ext.h"
+
+/*
+ * The enclave calls, dispatched by their number both as legacy calls
+ * (a7) and as FIDs of SBI_EXT_PENGLAI. Many of them switch the context
+ * in regs, so only a0 is written back, as it always was.
+ */
+#define SM_SBI_FN(name, call) \
+  static struct sbiret name(uintptr_t* regs) { return SBI_RET(0, (call)); }
+
+SM_SBI_FN(sbi_mm_init, sm_mm_init(regs[10], regs[11]))
+SM_SBI_FN(sbi_memory_extend, sm_mm_extend(regs[10], regs[11]))
+SM_SBI_FN(sbi_alloc_enclave_mm, sm_alloc_enclave_mem(regs[10]))
+SM_SBI_FN(sbi_memory_reclaim, sm_memory_reclaim(regs[10]))
+SM_SBI_FN(sbi_memory_compact, sm_memory_compact(regs[10]))
+SM_SBI_FN(sbi_evict_enclave_pages, sm_evict_enclave_pages(regs[10], regs[11]))
+SM_SBI_FN(sbi_create_enclave, sm_create_enclave(regs[10]))
+//TODO: attestation is not implemented yet
+SM_SBI_FN(sbi_attest_enclave, -1UL)
+SM_SBI_FN(sbi_run_enclave, sm_run_enclave(regs, regs[10], regs[11]))
+SM_SBI_FN(sbi_run_enclave_exclusive, sm_run_enclave_exclusive(regs, regs[10], regs[11]))
+SM_SBI_FN(sbi_migrate_enclave, sm_migrate_enclave(regs[10], regs[11], regs[12]))
+SM_SBI_FN(sbi_set_enclave_slice, sm_set_enclave_slice(regs[10], regs[11]))
+SM_SBI_FN(sbi_stop_enclave, sm_stop_enclave(regs, regs[10]))
+SM_SBI_FN(sbi_resume_enclave, sm_resume_enclave(regs, regs[10]))
+SM_SBI_FN(sbi_destroy_enclave, 0)
+SM_SBI_FN(sbi_enclave_ocall, sm_enclave_ocall(regs, regs[10], regs[11], regs[12]))
+SM_SBI_FN(sbi_exit_enclave, sm_exit_enclave(regs, regs[10]))
+SM_SBI_FN(sbi_yield_enclave, sm_yield_enclave(regs, regs[10]))
+SM_SBI_FN(sbi_call_enclave, sm_call_enclave(regs, regs[10], regs[11], regs[12]))
+SM_SBI_FN(sbi_enclave_return, sm_enclave_return(regs, regs[10]))
+SM_SBI_FN(sbi_create_shm, sm_create_shm(regs[10]))
+SM_SBI_FN(sbi_grant_shm, sm_grant_shm(regs[10], regs[11], regs[12]))
+SM_SBI_FN(sbi_attach_shm, sm_attach_shm(regs, regs[10], regs[11]))
+SM_SBI_FN(sbi_detach_shm, sm_detach_shm(regs))
+SM_SBI_FN(sbi_destroy_shm, sm_destroy_shm(regs[10]))
+SM_SBI_FN(sbi_alloc_relay_page, sm_alloc_relay_page(regs[10]))
+SM_SBI_FN(sbi_transfer_relay_page, sm_transfer_relay_page(regs[10], regs[11], regs[12]))
+SM_SBI_FN(sbi_return_relay_page, sm_return_relay_page(regs))
+SM_SBI_FN(sbi_free_relay_page, sm_free_relay_page(regs[10]))
+
+//TODO: delete this SBI_CALL
+static struct sbiret sbi_debug_print(uintptr_t* regs)
+{
+  printm("SBI_DEBUG_PRINT\r\n");
+  return SBI_RET(0, sm_debug_print(regs, regs[10]));
+}
+
+#define SM_SBI_NR (SBI_MM_INIT + 1)
+
+static const sbi_fn_t sm_sbi_fns[SM_SBI_NR] = {
+  [SBI_MM_INIT] = sbi_mm_init,
+  [SBI_MEMORY_EXTEND] = sbi_memory_extend,
+  [SBI_ALLOC_ENCLAVE_MM] = sbi_alloc_enclave_mm,
+  [SBI_MEMORY_RECLAIM] = sbi_memory_reclaim,
+  [SBI_MEMORY_COMPACT] = sbi_memory_compact,
+  [SBI_EVICT_ENCLAVE_PAGES] = sbi_evict_enclave_pages,
+  [SBI_CREATE_ENCLAVE] = sbi_create_enclave,
+  [SBI_ATTEST_ENCLAVE] = sbi_attest_enclave,
+  [SBI_RUN_ENCLAVE] = sbi_run_enclave,
+  [SBI_RUN_ENCLAVE_EXCLUSIVE] = sbi_run_enclave_exclusive,
+  [SBI_MIGRATE_ENCLAVE] = sbi_migrate_enclave,
+  [SBI_SET_ENCLAVE_SLICE] = sbi_set_enclave_slice,
+  [SBI_STOP_ENCLAVE] = sbi_stop_enclave,
+  [SBI_RESUME_ENCLAVE] = sbi_resume_enclave,
+  [SBI_DESTROY_ENCLAVE] = sbi_destroy_enclave,
+  [SBI_ENCLAVE_OCALL] = sbi_enclave_ocall,
+  [SBI_EXIT_ENCLAVE] = sbi_exit_enclave,
+  [SBI_YIELD_ENCLAVE] = sbi_yield_enclave,
+  [SBI_CALL_ENCLAVE] = sbi_call_enclave,
+  [SBI_ENCLAVE_RETURN] = sbi_enclave_return,
+  [SBI_CREATE_SHM] = sbi_create_shm,
+  [SBI_GRANT_SHM] = sbi_grant_shm,
+  [SBI_ATTACH_SHM] = sbi_attach_shm,
+  [SBI_DETACH_SHM] = sbi_detach_shm,
+  [SBI_DESTROY_SHM] = sbi_destroy_shm,
+  [SBI_ALLOC_RELAY_PAGE] = sbi_alloc_relay_page,
+  [SBI_TRANSFER_RELAY_PAGE] = sbi_transfer_relay_page,
+  [SBI_RETURN_RELAY_PAGE] = sbi_return_relay_page,
+  [SBI_FREE_RELAY_PAGE] = sbi_free_relay_page,
+  [SBI_DEBUG_PRINT] = sbi_debug_print,
+};
+
+static const struct sbi_ext sm_sbi_ext = {
+  SBI_EXT_PENGLAI, sm_sbi_fns, SM_SBI_NR, SBI_EXT_LEGACY_RET
+};
+
+void sm_sbi_init()
+{
+  int i;
+
+  sbi_register_ext(&sm_sbi_ext);
+  for(i = 0; i < SM_SBI_NR; ++i)
+  {
+    if(sm_sbi_fns[i])
+      sbi_register_legacy(i, sm_sbi_fns[i]);
+  }
+}
@@ -0,0 +1,193 @@
+#include "swap.h"
+#include "atomic.h"
+#include "mtrap.h"
+#include "fdt.h"
+#include "sm.h"
+#include <string.h>
+
+static uint8_t swap_master_key[CHACHA20_KEY_SIZE];
+static unsigned long swap_next_id = 0;
+static spinlock_t swap_lock = SPINLOCK_INIT;
+
+//entropy gathered for the master key, only usable once swap_seed_size is large enough
+static uint8_t swap_seed[CHACHA20_KEY_SIZE];
+static unsigned long swap_seed_size = 0;
+
+//nonces of the keystreams derived from swap_seed
+#define SWAP_NONCE_MIX      1
+#define SWAP_NONCE_MASTER   2
+#define SWAP_NONCE_SCRUB    3
+
+static void swap_seed_stream(uint8_t tag, uint32_t counter, uint8_t block[CHACHA20_BLOCK_SIZE])
+{
+  uint8_t nonce[CHACHA20_NONCE_SIZE];
+
+  memset(nonce, 0, sizeof(nonce));
+  nonce[0] = tag;
+  chacha20_block(swap_seed, counter, nonce, block);
+}
+
+//fold size bytes of seed into swap_seed
+static void swap_mix_seed(const uint8_t* seed, unsigned long size)
+{
+  uint8_t block[CHACHA20_BLOCK_SIZE];
+  unsigned long i;
+
+  for(i = 0; i < size; ++i)
+  {
+    swap_seed[i % CHACHA20_KEY_SIZE] ^= seed[i];
+    if(i % CHACHA20_KEY_SIZE == CHACHA20_KEY_SIZE - 1 || i == size - 1)
+    {
+      swap_seed_stream(SWAP_NONCE_MIX, 0, block);
+      memcpy(swap_seed, block, CHACHA20_KEY_SIZE);
+    }
+  }
+  swap_seed_size += size;
+  memset(block, 0, sizeof(block));
+}
+
+/*
+ * rng-seed and kaslr-seed of /chosen are taken for the swap key and then
+ * overwritten with a keystream of it, so the host, which gets this fdt,
+ * still gets fresh seeds but cannot tell the key from them.
+ */
+static void swap_seed_prop(const struct fdt_scan_prop *prop, void *extra)
+{
+  uint8_t block[CHACHA20_BLOCK_SIZE];
+  uint8_t* value = (uint8_t*)prop->value;
+  uint32_t* counter = (uint32_t*)extra;
+  int i;
+
+  if(!prop->node->parent || prop->node->parent->parent || strcmp(prop->node->name, "chosen"))
+    return;
+  if(strcmp(prop->name, "rng-seed") && strcmp(prop->name, "kaslr-seed"))
+    return;
+
+  swap_mix_seed(value, prop->len);
+  for(i = 0; i < prop->len; ++i)
+  {
+    if(i % CHACHA20_BLOCK_SIZE == 0)
+      swap_seed_stream(SWAP_NONCE_SCRUB, (*counter)++, block);
+    value[i] = block[i % CHACHA20_BLOCK_SIZE];
+  }
+  memset(block, 0, sizeof(block));
+}
+
+void query_swap_seed(uintptr_t fdt)
+{
+  struct fdt_cb cb;
+  uint32_t counter = 0;
+
+  memset(&cb, 0, sizeof(cb));
+  cb.prop = swap_seed_prop;
+  cb.extra = &counter;
+
+  fdt_scan(fdt, &cb);
+}
+
+/*
+ * Derive the master key from the seeds of the fdt and the platform TRNG.
+ * Without enough of them there is no key, timing jitter alone is easy to
+ * guess for the host, which decides when the first page is evicted.
+ */
+static int swap_seed_master_key()
+{
+  uint8_t seed[CHACHA20_KEY_SIZE];
+  uint8_t block[CHACHA20_BLOCK_SIZE];
+
+  if(platform_get_entropy(seed, sizeof(seed)) == 0)
+    swap_mix_seed(seed, sizeof(seed));
+  memset(seed, 0, sizeof(seed));
+  if(swap_seed_size < SWAP_MIN_SEED_SIZE)
+    return -1;
+
+  swap_seed_stream(SWAP_NONCE_MASTER, 0, block);
+  memcpy(swap_master_key, block, CHACHA20_KEY_SIZE);
+  memset(block, 0, sizeof(block));
+  return 0;
+}
+
+//every enclave swapping pages gets an id, which is never reused until reboot,
+//0 means there is no entropy for the swap key
+unsigned long swap_alloc_id()
+{
+  unsigned long id = 0;
+
+  spinlock_lock(&swap_lock);
+  if(swap_next_id == 0 && swap_seed_master_key() == 0)
+    swap_next_id = 1;
+  if(swap_next_id)
+    id = swap_next_id++;
+  spinlock_unlock(&swap_lock);
+
+  return id;
+}
+
+//the key of an enclave is the keystream of the master key at nonce swap_id
+static void swap_derive_key(unsigned long swap_id, uint8_t key[CHACHA20_KEY_SIZE])
+{
+  uint8_t nonce[CHACHA20_NONCE_SIZE];
+  uint8_t block[CHACHA20_BLOCK_SIZE];
+
+  memset(nonce, 0, sizeof(nonce));
+  memcpy(nonce, &swap_id, sizeof(swap_id));
+  chacha20_block(swap_master_key, 0, nonce, block);
+  memcpy(key, block, CHACHA20_KEY_SIZE);
+  memset(block, 0, sizeof(block));
+}
+
+//the version is unique per enclave, so it is used as nonce
+static void swap_nonce_and_aad(uintptr_t va, unsigned long version,
+    uint8_t nonce[CHACHA20_NONCE_SIZE], unsigned long aad[2])
+{
+  memset(nonce, 0, CHACHA20_NONCE_SIZE);
+  memcpy(nonce, &version, sizeof(version));
+  aad[0] = va;
+  aad[1] = version;
+}
+
+void swap_encrypt_page(unsigned long swap_id, uintptr_t va, unsigned long version,
+    void* page, struct swap_slot_t* slot)
+{
+  uint8_t key[CHACHA20_KEY_SIZE];
+  uint8_t nonce[CHACHA20_NONCE_SIZE];
+  unsigned long aad[2];
+
+  swap_derive_key(swap_id, key);
+  swap_nonce_and_aad(va, version, nonce, aad);
+
+  chacha20poly1305_encrypt(key, nonce, (uint8_t*)aad, sizeof(aad),
+      slot->data, page, RISCV_PGSIZE, slot->tag);
+  slot->va = va;
+
+  memset(key, 0, sizeof(key));
+}
+
+/*
+ * Decrypt a swapped page into page. The slot lives in host memory and may
+ * change under our feet, so the ciphertext and the tag are copied into
+ * page first and checked there. Return -1 if the page has been tampered.
+ */
+int swap_decrypt_page(unsigned long swap_id, uintptr_t va, unsigned long version,
+    struct swap_slot_t* slot, void* page)
+{
+  uint8_t key[CHACHA20_KEY_SIZE];
+  uint8_t nonce[CHACHA20_NONCE_SIZE];
+  uint8_t tag[POLY1305_TAG_SIZE];
+  unsigned long aad[2];
+  int retval;
+
+  memcpy(page, slot->data, RISCV_PGSIZE);
+  memcpy(tag, slot->tag, POLY1305_TAG_SIZE);
+
+  swap_derive_key(swap_id, key);
+  swap_nonce_and_aad(va, version, nonce, aad);
+
+  retval = chacha20poly1305_decrypt(key, nonce, (uint8_t*)aad, sizeof(aad),
+      page, page, RISCV_PGSIZE, tag);
+  if(retval < 0)
+    memset(page, 0, RISCV_PGSIZE);
+
+  memset(key, 0, sizeof(key));
+  return retval;
+}
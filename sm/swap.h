@@ -0,0 +1,59 @@
+#ifndef _SM_SWAP_H
+#define _SM_SWAP_H
+
+#include <stdint.h>
+#include "encoding.h"
+#include "vm.h"
+#include "chacha20poly1305.h"
+
+/*
+ * Enclave pages evicted to host memory
+ *
+ * The host gives an enclave a swap area, an array of struct swap_slot_t.
+ * An evicted page is encrypted and MACed with a per-enclave key derived
+ * from a key only known by the security monitor. The pte of the page
+ * stays in enclave's page table with V cleared and records the slot and
+ * a version, which is the nonce and part of the MACed data with the va,
+ * so the host can neither read, modify, move nor replay a swapped page.
+ */
+struct swap_slot_t
+{
+  volatile unsigned long state;
+  unsigned long va;
+  uint8_t tag[POLY1305_TAG_SIZE];
+  uint8_t data[RISCV_PGSIZE];
+};
+
+//state of a swap slot, the host may only reuse a FREE slot
+#define SWAP_SLOT_FREE      0
+#define SWAP_SLOT_USED      1
+
+//pte of a swapped page: V and the RSW bit 8 tell it apart, R/W/X/U are kept
+#define PTE_SWAPPED         0x100
+#define SWAP_PTE_PERM       (PTE_R | PTE_W | PTE_X | PTE_U)
+#define SWAP_VERSION_SHIFT  PTE_PPN_SHIFT
+#define SWAP_VERSION_BITS   30
+#define SWAP_SLOT_SHIFT     (SWAP_VERSION_SHIFT + SWAP_VERSION_BITS)
+#define SWAP_SLOT_BITS      24
+#define SWAP_MAX_VERSION    ((1UL << SWAP_VERSION_BITS) - 1)
+#define SWAP_MAX_SLOTS      (1UL << SWAP_SLOT_BITS)
+
+#define SWAP_PTE(slot, version, perm) (PTE_SWAPPED | ((perm) & SWAP_PTE_PERM) \
+    | ((uintptr_t)(version) << SWAP_VERSION_SHIFT) | ((uintptr_t)(slot) << SWAP_SLOT_SHIFT))
+#define SWAP_PTE_SLOT(pte) (((pte) >> SWAP_SLOT_SHIFT) & (SWAP_MAX_SLOTS - 1))
+#define SWAP_PTE_VERSION(pte) (((pte) >> SWAP_VERSION_SHIFT) & SWAP_MAX_VERSION)
+
+//bytes of seed needed before pages are swapped
+#define SWAP_MIN_SEED_SIZE  16
+
+void query_swap_seed(uintptr_t fdt);
+
+unsigned long swap_alloc_id();
+
+void swap_encrypt_page(unsigned long swap_id, uintptr_t va, unsigned long version,
+    void* page, struct swap_slot_t* slot);
+
+int swap_decrypt_page(unsigned long swap_id, uintptr_t va, unsigned long version,
+    struct swap_slot_t* slot, void* page);
+
+#endif /* _SM_SWAP_H */
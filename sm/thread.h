@@ -10,10 +10,10 @@
 //##################### 0xffffffe000000000
 //#       hole        #
 //##################### 0x0000004000000000
-//#       stack       #
+//#  thread stacks    #
 //#                   #
 //#       heap        #
-//##################### 0x0000002000000000
+//##################### 0x0000002000000000 (ENCLAVE_DEMAND_PAGING_BASE)
 //#  untrusted memory #
 //#  shared with host #
 //##################### 0x0000001000000000
@@ -22,7 +22,13 @@
 //#       hole        #
 //##################### 0x0
 
-#define ENCLAVE_DEFAULT_STACK 0x0000004000000000;
+#define ENCLAVE_DEFAULT_STACK 0x0000004000000000
+
+//pages of heap and stacks are mapped by the security monitor when touched
+#define ENCLAVE_DEMAND_PAGING_BASE 0x0000002000000000
+
+//stack of thread i grows down from ENCLAVE_DEFAULT_STACK - i * ENCLAVE_THREAD_STACK_SIZE
+#define ENCLAVE_THREAD_STACK_SIZE 0x0000000000800000
 
 #define N_GENERAL_REGISTERS 32
 
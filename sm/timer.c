@@ -0,0 +1,54 @@
+#include "timer.h"
+#include "mtrap.h"
+
+static uint64_t timer_queues[MAX_HARTS][N_TIMERS];
+
+void timer_set(int timer, uint64_t deadline)
+{
+  timer_queues[read_csr(mhartid)][timer] = deadline;
+}
+
+uint64_t timer_get(int timer)
+{
+  return timer_queues[read_csr(mhartid)][timer];
+}
+
+/*
+ * Return a bitmap of the timers expired at now.
+ * The enclave timers are disarmed, the host timer is kept until
+ * the host reprograms it.
+ */
+unsigned long timer_fired(uint64_t now)
+{
+  uint64_t* timers = timer_queues[read_csr(mhartid)];
+  unsigned long fired = 0;
+  int i;
+
+  for(i = 0; i < N_TIMERS; ++i)
+  {
+    if(timers[i] > now)
+      continue;
+
+    fired |= 1UL << i;
+    if(i != TIMER_HOST)
+      timers[i] = TIMER_NONE;
+  }
+
+  return fired;
+}
+
+//program mtimecmp with the earliest deadline
+void timer_program()
+{
+  uint64_t* timers = timer_queues[read_csr(mhartid)];
+  uint64_t deadline = TIMER_NONE;
+  int i;
+
+  for(i = 0; i < N_TIMERS; ++i)
+  {
+    if(timers[i] < deadline)
+      deadline = timers[i];
+  }
+
+  *HLS()->timecmp = deadline;
+}
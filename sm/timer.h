@@ -0,0 +1,29 @@
+#ifndef _SM_TIMER_H
+#define _SM_TIMER_H
+
+#include <stdint.h>
+
+/*
+ * Per-hart timer queue multiplexing mtimecmp.
+ * TIMER_HOST is the deadline programmed by the host, TIMER_QUANTUM the
+ * end of the time slice of the running enclave thread and TIMER_ENCLAVE
+ * the deadline set by the running enclave thread itself.
+ * Out of the enclave world only TIMER_HOST is armed, so mtimecmp always
+ * belongs to the host there.
+ */
+#define TIMER_HOST      0
+#define TIMER_QUANTUM   1
+#define TIMER_ENCLAVE   2
+#define N_TIMERS        3
+
+#define TIMER_NONE      (-1ULL)
+
+void timer_set(int timer, uint64_t deadline);
+
+uint64_t timer_get(int timer);
+
+unsigned long timer_fired(uint64_t now);
+
+void timer_program();
+
+#endif /* _SM_TIMER_H */